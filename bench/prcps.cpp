@@ -0,0 +1,120 @@
+/**
+ * @brief JUDAH - Jacob is equipped with a text-based user interface
+ *
+ * @file bench/prcps.cpp
+ * @author  Norbert Bátfai <nbatfai@gmail.com>
+ * @version 0.0.1
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2015 Norbert Bátfai, batfai.norbert@inf.unideb.hu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * JACOB, https://github.com/nbatfai/jacob
+ *
+ * "The son of Isaac is Jacob." The project called Jacob is an experiment
+ * to replace Isaac's (GUI based) visual imagination with a character console.
+ *
+ * ISAAC, https://github.com/nbatfai/isaac
+ *
+ * "The son of Samu is Isaac." The project called Isaac is a case study
+ * of using deep Q learning with neural networks for predicting the next
+ * sentence of a conversation.
+ *
+ * SAMU, https://github.com/nbatfai/samu
+ *
+ * The main purpose of this project is to allow the evaluation and
+ * verification of the results of the paper entitled "A disembodied
+ * developmental robotic agent called Samu Bátfai". It is our hope
+ * that Samu will be the ancestor of developmental robotics chatter
+ * bots that will be able to chat in natural language like humans do.
+ *
+ */
+
+// The sweep of the action perceptrons of the character console: 400
+// perceptrons of 800-32-1 are evaluated on one image, then each learns
+// it. Only the interface of the original Perceptron is used, so the
+// same driver times the layouts before and after the arena (build it
+// against the older ql.hpp for the former).
+//
+//   bench [perceptrons] [sweeps]
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "ql.hpp"
+
+#ifdef FLOAT_PRCPS
+typedef float Pixel;
+#else
+typedef double Pixel;
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static void report ( const char * name, std::vector<double> & t )
+{
+  std::sort ( t.begin(), t.end() );
+  std::printf ( "%-8s %.2f ms (min %.2f)\n", name, t[t.size() / 2], t[0] );
+}
+
+int main ( int argc, char ** argv )
+{
+  int n = argc > 1 ? std::atoi ( argv[1] ) : 400;
+  int sweeps = argc > 2 ? std::atoi ( argv[2] ) : 50;
+
+  std::vector<Perceptron *> prcps;
+  for ( int i {0}; i < n; ++i )
+    prcps.push_back ( new Perceptron ( 3, 10*80, 32, 1 ) );
+
+  // a few short lines of text on the console, the rest is blank
+  Pixel image[10*80] {};
+  for ( int r {0}; r < 4; ++r )
+    for ( int c {0}; c < 30; ++c )
+      image[r*80 + c] = ( 'a' + ( r*7 + c ) % 26 ) / 255.0;
+
+  std::vector<double> forward, learning;
+  double sum {0.0};
+
+  for ( int s {0}; s < sweeps; ++s )
+    {
+      auto t = Clock::now();
+      for ( Perceptron * p : prcps )
+        sum += ( *p ) ( image );
+      forward.push_back ( std::chrono::duration<double, std::milli> ( Clock::now() - t ).count() );
+
+      t = Clock::now();
+      for ( Perceptron * p : prcps )
+        {
+          double q = ( *p ) ( image );
+          p->learning ( image, .7, q );
+        }
+      learning.push_back ( std::chrono::duration<double, std::milli> ( Clock::now() - t ).count() );
+    }
+
+  std::printf ( "%d perceptrons of 800-32-1, %d sweeps\n", n, sweeps );
+  report ( "forward", forward );
+  report ( "learning", learning );
+  std::printf ( "checksum %.6f\n", sum );
+
+  for ( Perceptron * p : prcps )
+    delete p;
+
+  return 0;
+}
@@ -57,26 +57,69 @@ Samu samu;
 
 bool halted {false};
 
-void save_samu ( int sig )
+// the signal handler only raises these flags, save_samu serves them
+// between the steps of the learning
+volatile sig_atomic_t halt_signal {0};
+volatile sig_atomic_t snapshot_signal {0};
+
+void on_signal ( int sig )
+{
+  if ( sig == SIGUSR1 )
+    snapshot_signal = 1;
+  else
+    halt_signal = 1;
+}
+
+#ifndef Q_LOOKUP_TABLE
+// a delta checkpoint of the soul is journaled about once a minute and a
+// snapshot is taken every quarter of an hour
+std::chrono::steady_clock::time_point checkpoint {std::chrono::steady_clock::now() };
+std::chrono::steady_clock::time_point snapshot {std::chrono::steady_clock::now() };
+#endif
+
+void save_samu ( void )
 {
+#ifndef Q_LOOKUP_TABLE
+  std::string samuImage {"samu.soul"};
+#endif
 
-  if ( halted )
-    return;
-  halted = true;
+  if ( halt_signal )
+    {
+      if ( halted )
+        return;
+      halted = true;
 
 #ifndef Q_LOOKUP_TABLE
-  std::string samuImage {"samu.soul.txt"};
-  samu.save ( samuImage );
+      samu.save ( samuImage );
 #endif
 
-  samu.halt();
-  exit ( 0 );
+      samu.halt();
+      exit ( 0 );
+    }
+
+#ifndef Q_LOOKUP_TABLE
+  auto now = std::chrono::steady_clock::now();
+
+  if ( snapshot_signal || samu.save_requested() || now - snapshot > std::chrono::minutes ( 15 ) )
+    {
+      snapshot_signal = 0;
+      samu.snapshot ( samuImage );
+      snapshot = now;
+    }
+  else if ( now - checkpoint > std::chrono::minutes ( 1 ) )
+    {
+      samu.checkpoint ( samuImage );
+      checkpoint = now;
+    }
+#endif
 }
 
 double to_samu ( int channel, SPOTriplets &tv )
 {
   double r {0.0};
 
+  save_samu();
+
   try
     {
       samu.triplet ( channel, tv );
@@ -94,6 +137,8 @@ double to_samu ( int channel, std::string &msg )
 {
   double r {0.0};
 
+  save_samu();
+
   try
     {
       samu.sentence ( channel, msg );
@@ -110,6 +155,8 @@ double to_samu ( int channel, std::string &msg, std::string &key )
 {
   double r {0.0};
 
+  save_samu();
+
   try
     {
       samu.sentence ( channel, msg, key );
@@ -153,15 +200,34 @@ int main ( int argc, char **argv )
 {
 
 #ifndef Q_LOOKUP_TABLE
-  std::string samuImage {"samu.soul.txt"};
+  std::string samuImage {"samu.soul"};
 
-  std::fstream samuFile ( samuImage,  std::ios_base::in );
+  std::fstream samuFile ( samuImage,  std::ios_base::in | std::ios_base::binary );
+  bool binary = samuFile.is_open();
+  // the text soul of the earlier versions
+  if ( !samuFile )
+    samuFile.open ( "samu.soul.txt",  std::ios_base::in );
   if ( samuFile )
-    samu.load ( samuFile );
+    {
+      try
+        {
+          // by name, so that it can be mapped (MMAP_SOUL)
+          if ( binary )
+            samu.load ( samuImage );
+          else
+            samu.convert ( samuFile, samuImage );
+        }
+      catch ( const char* err )
+        {
+          std::cerr << err << std::endl;
+          samu.halt();
+          return -1;
+        }
+    }
 #endif
 
   struct sigaction sa;
-  sa.sa_handler = save_samu;
+  sa.sa_handler = on_signal;
   sigemptyset ( &sa.sa_mask );
   sa.sa_flags = SA_RESTART;
 
@@ -169,6 +235,7 @@ int main ( int argc, char **argv )
   sigaction ( SIGTERM, &sa, NULL );
   sigaction ( SIGKILL, &sa, NULL );
   sigaction ( SIGHUP, &sa, NULL );
+  sigaction ( SIGUSR1, &sa, NULL );
 
   // Do not remove this copyright notice!
   std::cerr << "This program is Isaac, the son of Samu Bátfai."
@@ -254,6 +321,8 @@ int main ( int argc, char **argv )
     //for ( int ii {0}; samu.run() && ii < 50; ++ii )
 #endif
     {
+      save_samu();
+
       auto start = std::chrono::high_resolution_clock::now();
       double sum {0.0};
       int cnt {0};
@@ -397,6 +466,28 @@ int main ( int argc, char **argv )
                     << N_e
                     << std::endl;
 
+#ifdef STORE_PRCPS
+          const QL::StoreStats & store = samu.get_store_stats();
+          std::cerr << "perceptron store, hit rate: "
+                    << ( store.hits + store.misses ? ( 100.0 * store.hits ) / ( store.hits + store.misses ) : 100.0 )
+                    << "%, spilled: "
+                    << store.spills
+                    << " ("
+                    << ( store.spilled_bytes >> 20 )
+                    << " MB), reloaded: "
+                    << store.misses
+                    << " ("
+                    << ( store.reloaded_bytes >> 20 )
+                    << " MB)"
+#ifdef PRUNE_PRCPS
+                    << ", retired: "
+                    << store.retired
+                    << ", restored: "
+                    << store.restored
+#endif
+                    << std::endl;
+#endif
+
           /*
             //if ( fabs ( prev_mbrel - mbrel ) < 1.2 )
             if ( mbrel  < 0.0 )
@@ -512,7 +603,6 @@ int main ( int argc, char **argv )
                   }
           */
           prev_mbrel = mbrel;
-
         }
       else
         sleep ( 1 );
@@ -520,7 +610,7 @@ int main ( int argc, char **argv )
 
 #ifndef Q_LOOKUP_TABLE
   {
-    std::string samuImage {"samu.soul.txt"};
+    std::string samuImage {"samu.soul"};
     samu.save ( samuImage );
   }
 #endif
@@ -0,0 +1,174 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+/**
+ * @brief JUDAH - Jacob is equipped with a text-based user interface
+ *
+ * @file pool.hpp
+ * @author  Norbert Bátfai <nbatfai@gmail.com>
+ * @version 0.0.1
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2015 Norbert Bátfai, batfai.norbert@inf.unideb.hu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * JACOB, https://github.com/nbatfai/jacob
+ *
+ * "The son of Isaac is Jacob." The project called Jacob is an experiment
+ * to replace Isaac's (GUI based) visual imagination with a character console.
+ *
+ * ISAAC, https://github.com/nbatfai/isaac
+ *
+ * "The son of Samu is Isaac." The project called Isaac is a case study
+ * of using deep Q learning with neural networks for predicting the next
+ * sentence of a conversation.
+ *
+ * SAMU, https://github.com/nbatfai/samu
+ *
+ * The main purpose of this project is to allow the evaluation and
+ * verification of the results of the paper entitled "A disembodied
+ * developmental robotic agent called Samu Bátfai". It is our hope
+ * that Samu will be the ancestor of developmental robotics chatter
+ * bots that will be able to chat in natural language like humans do.
+ *
+ */
+
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <mutex>
+
+// A persistent pool of worker threads for the evaluation of the action
+// perceptrons. A call splits the range [0, n) evenly among the threads,
+// the calling thread takes the first part and waits for the others. The
+// number of the threads (the calling one included) is given by the
+// SAMU_THREADS environment variable, by default it is the number of cores.
+class ThreadPool
+{
+public:
+  ThreadPool ( int n_threads = threads() )
+  {
+    for ( int t {1}; t < n_threads; ++t )
+      workers.emplace_back ( &ThreadPool::work, this, t );
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::unique_lock<std::mutex> lock ( mutex );
+      stop = true;
+    }
+    start.notify_all();
+
+    for ( auto & worker : workers )
+      worker.join();
+  }
+
+  // calls f ( i ) for all i in [0, n)
+  void operator() ( int n, const std::function<void ( int ) > & f )
+  {
+    if ( workers.empty() || n < 2 )
+      {
+        for ( int i {0}; i < n; ++i )
+          f ( i );
+
+        return;
+      }
+
+    {
+      std::unique_lock<std::mutex> lock ( mutex );
+      job = &f;
+      range = n;
+      pending = workers.size();
+      ++generation;
+    }
+    start.notify_all();
+
+    run ( 0, n );
+
+    std::unique_lock<std::mutex> lock ( mutex );
+    done.wait ( lock, [this] { return pending == 0; } );
+    job = nullptr;
+  }
+
+  static int threads ( void )
+  {
+    const char * n = std::getenv ( "SAMU_THREADS" );
+
+    if ( n && std::atoi ( n ) > 0 )
+      return std::atoi ( n );
+
+    unsigned int cores = std::thread::hardware_concurrency();
+
+    return cores ? cores : 1;
+  }
+
+private:
+  ThreadPool ( const ThreadPool & );
+  ThreadPool & operator= ( const ThreadPool & );
+
+  void run ( int t, int n )
+  {
+    int n_threads = workers.size() + 1;
+
+    for ( int i = n * t / n_threads; i < n * ( t+1 ) / n_threads; ++i )
+      ( *job ) ( i );
+  }
+
+  void work ( int t )
+  {
+    unsigned long seen {0};
+
+    for ( ;; )
+      {
+        int n;
+        {
+          std::unique_lock<std::mutex> lock ( mutex );
+          start.wait ( lock, [this, seen] { return stop || generation != seen; } );
+
+          if ( stop )
+            return;
+
+          seen = generation;
+          n = range;
+        }
+
+        run ( t, n );
+
+        {
+          std::unique_lock<std::mutex> lock ( mutex );
+          --pending;
+        }
+        done.notify_one();
+      }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  const std::function<void ( int ) > * job {nullptr};
+  int range {0};
+  int pending {0};
+  unsigned long generation {0};
+  bool stop {false};
+};
+
+#endif
@@ -56,11 +56,127 @@
 #include <random>
 #include <limits>
 #include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <sys/wait.h>
 
 #include "nlp.hpp"
 #include "qlc.h"
+#include "simd.hpp"
+#include "pool.hpp"
+#include "soul.hpp"
+
+// The action perceptrons are evaluated in parallel by a pool of threads,
+// unless the parallelism is inside the perceptrons (OpenMP) or the first
+// layers are fused into one pass.
+#if !defined(OMP_PRCPS) && !defined(FUSED_PRCPS)
+#define POOL_PRCPS
+#endif
+
+// The perceptrons spilled by the memory budget and the retired actions are
+// kept in the same store.
+#if defined(SPILL_PRCPS) || defined(PRUNE_PRCPS)
+#define STORE_PRCPS
+#endif
+
+#ifdef TRUNK_PRCPS
+#if defined(FUSED_PRCPS) || defined(INT8_PRCPS)
+#error "TRUNK_PRCPS cannot be combined with FUSED_PRCPS or INT8_PRCPS"
+#endif
+#endif
+
+#if defined(REPLAY_PRCPS) && defined(Q_LOOKUP_TABLE)
+#error "REPLAY_PRCPS replays the transitions to the perceptrons"
+#endif
+
+#ifdef FLOAT_PRCPS
+#ifdef CUDA_PRCPS
+#error "FLOAT_PRCPS is a CPU only mode"
+#endif
+typedef float Real;
+#else
+typedef double Real;
+#endif
 
 #ifndef Q_LOOKUP_TABLE
+// The non-zero inputs of an image. They are collected once per image
+// and shared by all the perceptrons that evaluate it. The character console
+// is mostly empty, so below the density limit the first layers read only
+// the weight columns of these inputs.
+class ActiveInputs
+{
+public:
+
+  void operator() ( const Real image [], int n )
+  {
+    idx.clear();
+    val.clear();
+
+    for ( int k {0}; k < n; ++k )
+      if ( image[k] != 0.0 )
+        {
+          idx.push_back ( k );
+          val.push_back ( image[k] );
+        }
+
+    sparse = idx.size() < density * n;
+  }
+
+  std::vector<int> idx;
+  std::vector<Real> val;
+  bool sparse {false};
+
+  // measured crossover of the sparse and the dense kernels is about .4
+  static constexpr double density {.3};
+};
+
+#if defined(INT8_PRCPS) || defined(REPLAY_PRCPS)
+// Symmetric int8 quantization of an image for the inference-only mode and
+// the replay buffer, image[k] ~ scale * q[k].
+class QuantizedInputs
+{
+public:
+
+  void operator() ( const Real image [], int n )
+  {
+    q.resize ( n );
+
+    Real m {0};
+    for ( int k {0}; k < n; ++k )
+      m = std::max ( m, std::fabs ( image[k] ) );
+
+    scale = m > 0 ? m / 127.0f : 1.0f;
+
+    for ( int k {0}; k < n; ++k )
+      q[k] = static_cast<int8_t> ( std::lround ( image[k] / scale ) );
+  }
+
+  void restore ( Real image [] ) const
+  {
+    for ( std::size_t k {0}; k < q.size(); ++k )
+      image[k] = scale * q[k];
+  }
+
+  std::vector<int8_t> q;
+  float scale {1.0f};
+};
+#endif
+
 class Perceptron
 {
 public:
@@ -68,7 +184,6 @@ public:
   {
     n_layers = nof;
 
-    units = new double*[n_layers];
     n_units = new int[n_layers];
 
     va_list vap;
@@ -78,894 +193,4059 @@ public:
     for ( int i {0}; i < n_layers; ++i )
       {
         n_units[i] = va_arg ( vap, int );
-
-        if ( i )
-          units[i] = new double [n_units[i]];
       }
 
     va_end ( vap );
 
-    weights = new double**[n_layers-1];
+    randomize();
+  }
 
-#ifndef RND_DEBUG
-    std::random_device init;
-    std::default_random_engine gen {init() };
-#else
-    std::default_random_engine gen;
+  // the numbers of the units of the layers are given by the topology
+  explicit Perceptron ( const std::vector<int> & topology )
+  {
+    n_layers = topology.size();
+
+    n_units = new int[n_layers];
+
+    std::copy ( topology.begin(), topology.end(), n_units );
+
+    randomize();
+  }
+
+#ifdef TRUNK_PRCPS
+  // An output head on the top layer of a trunk perceptron that is shared
+  // by all the heads.
+  Perceptron ( Perceptron * trunk, int n_out ) : Perceptron ( 2, trunk->n_units[trunk->n_layers-1], n_out )
+  {
+    this->trunk = trunk;
+  }
 #endif
 
-    std::uniform_real_distribution<double> dist ( -1.0, 1.0 );
+  Perceptron ( std::fstream & file, Perceptron * trunk = nullptr )
+  {
+    file >> n_layers;
 
-    for ( int i {1}; i < n_layers; ++i )
+    n_units = new int[n_layers];
+
+    for ( int i {0}; i < n_layers; ++i )
       {
-        weights[i-1] = new double *[n_units[i]];
+        file >> n_units[i];
+      }
 
+#ifdef TRUNK_PRCPS
+    if ( trunk && trunk->n_units[trunk->n_layers-1] != n_units[0] )
+      throw "The head does not fit the trunk.";
+
+    this->trunk = trunk;
+#endif
+
+    alloc();
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
         for ( int j {0}; j < n_units[i]; ++j )
           {
-            weights[i-1][j] = new double [n_units[i-1]];
+            Real * w = row ( i-1, j );
 
             for ( int k {0}; k < n_units[i-1]; ++k )
               {
-                weights[i-1][j][k] = dist ( gen );
+                file >> w[k];
               }
           }
       }
   }
 
-  Perceptron ( std::fstream & file )
+  // A perceptron block of a binary soul, the weights are converted
+  // if the soul has been saved in the other precision.
+  Perceptron ( SoulReader & in, Perceptron * trunk = nullptr )
   {
-    file >> n_layers;
+    n_layers = in.get<uint32_t>();
+
+    if ( n_layers < 2 || n_layers > 64 )
+      throw "The soul is corrupted.";
 
-    units = new double*[n_layers];
     n_units = new int[n_layers];
 
     for ( int i {0}; i < n_layers; ++i )
       {
-        file >> n_units[i];
+        n_units[i] = in.get<uint32_t>();
 
-        if ( i )
-          units[i] = new double [n_units[i]];
+        if ( n_units[i] < 1 || n_units[i] > 1 << 24 )
+          {
+            delete [] n_units;
+            throw "The soul is corrupted.";
+          }
       }
 
-    weights = new double**[n_layers-1];
+    in.align();
 
-    for ( int i {1}; i < n_layers; ++i )
+#ifdef TRUNK_PRCPS
+    if ( trunk && trunk->n_units[trunk->n_layers-1] != n_units[0] )
       {
-        weights[i-1] = new double *[n_units[i]];
+        delete [] n_units;
+        throw "The head does not fit the trunk.";
+      }
 
-        for ( int j {0}; j < n_units[i]; ++j )
+    this->trunk = trunk;
+#endif
+
+    alloc();
+
+    // the arena is given back if the weights cannot be read
+    std::unique_ptr<Perceptron, Dealloc> partial ( this );
+
+    if ( in.real_size == sizeof ( Real ) )
+      {
+        in.read ( weights[0], n_weights() * sizeof ( Real ) );
+      }
+    else
+      {
+        std::vector<char> buf;
+
+        for ( int i {1}; i < n_layers; ++i )
           {
-            weights[i-1][j] = new double [n_units[i-1]];
+            buf.resize ( SoulReader::padded ( n_units[i-1], in.real_size ) * in.real_size );
 
-            for ( int k {0}; k < n_units[i-1]; ++k )
+            for ( int j {0}; j < n_units[i]; ++j )
               {
-                file >> weights[i-1][j][k];
+                in.read ( buf.data(), buf.size() );
+
+                Real * w = row ( i-1, j );
+
+                for ( int k {0}; k < n_units[i-1]; ++k )
+                  {
+                    if ( in.real_size == sizeof ( float ) )
+                      w[k] = reinterpret_cast<float *> ( buf.data() ) [k];
+                    else
+                      w[k] = reinterpret_cast<double *> ( buf.data() ) [k];
+                  }
               }
           }
       }
-  }
-
 
-  double sigmoid ( double x )
-  {
-    return 1.0/ ( 1.0 + exp ( -x ) );
+    partial.release();
   }
 
 
-  double operator() ( double image [] )
+#ifdef MMAP_SOUL
+  // A perceptron block of a soul mapped into the memory (see SoulMapping),
+  // the weights are used in place, so they are paged in on first use and
+  // only the pages of a perceptron that learns are copied.
+  Perceptron ( char * block, const char * end, Perceptron * trunk = nullptr )
   {
+    uint32_t n;
 
-    units[0] = image;
-
-    for ( int i {1}; i < n_layers; ++i )
-      {
+    if ( end - block < 4 )
+      throw "The soul is truncated.";
 
-#ifdef CUDA_PRCPS
+    std::memcpy ( &n, block, 4 );
+    n_layers = n;
 
-        cuda_layer ( i, n_units, units, weights );
+    if ( n_layers < 2 || n_layers > 64 )
+      throw "The soul is corrupted.";
 
-#else
+    std::ptrdiff_t header = ( ( 4 * ( 1 + n_layers ) + align - 1 ) / align ) * align;
 
-        #pragma omp parallel for
-        for ( int j = 0; j < n_units[i]; ++j )
-          {
-            units[i][j] = 0.0;
+    if ( end - block < header )
+      throw "The soul is truncated.";
 
-            for ( int k = 0; k < n_units[i-1]; ++k )
-              {
-                units[i][j] += weights[i-1][j][k] * units[i-1][k];
-              }
+    n_units = new int[n_layers];
 
-            units[i][j] = sigmoid ( units[i][j] );
+    for ( int i {0}; i < n_layers; ++i )
+      {
+        std::memcpy ( &n, block + 4 * ( 1 + i ), 4 );
+        n_units[i] = n;
 
+        if ( n_units[i] < 1 || n_units[i] > 1 << 24 )
+          {
+            delete [] n_units;
+            throw "The soul is corrupted.";
           }
+      }
+
+#ifdef TRUNK_PRCPS
+    if ( trunk && trunk->n_units[trunk->n_layers-1] != n_units[0] )
+      {
+        delete [] n_units;
+        throw "The head does not fit the trunk.";
+      }
 
+    this->trunk = trunk;
 #endif
 
+    if ( static_cast<std::size_t> ( end - block - header ) < n_weights() * sizeof ( Real ) )
+      {
+        delete [] n_units;
+        throw "The soul is truncated.";
       }
 
-    return sigmoid ( units[n_layers - 1][0] );
-
+    alloc ( reinterpret_cast<Real *> ( block + header ) );
   }
+#endif
 
-  void learning ( double image [], double q, double prev_q )
+  double sigmoid ( double x )
   {
-    double y[1] {q};
-
-    learning ( image, y );
+    return 1.0/ ( 1.0 + exp ( -x ) );
   }
 
-  void learning ( double image [], double y[] )
+
+  double operator() ( Real image [] )
   {
-    //( *this ) ( image );
+
+#ifdef TRUNK_PRCPS
+    if ( trunk )
+      {
+        ( *trunk ) ( image );
+        units[0] = trunk->top();
+
+        return forward ( 1 );
+      }
+#endif
 
     units[0] = image;
 
-    double ** backs = new double*[n_layers-1];
+    return forward ( 1 );
 
-    for ( int i {0}; i < n_layers-1; ++i )
-      {
-        backs[i] = new double [n_units[i+1]];
-      }
+  }
 
-    int i {n_layers-1};
+  double operator() ( Real image [], const ActiveInputs & active )
+  {
 
-    for ( int j {0}; j < n_units[i]; ++j )
+#ifdef TRUNK_PRCPS
+    if ( trunk )
       {
-        backs[i-1][j] = sigmoid ( units[i][j] ) * ( 1.0-sigmoid ( units[i][j] ) ) * ( y[j] - units[i][j] );
-
-        for ( int k {0}; k < n_units[i-1]; ++k )
-          {
-            weights[i-1][j][k] += ( 0.2* backs[i-1][j] *units[i-1][k] );
-          }
+        ( *trunk ) ( image, active );
+        units[0] = trunk->top();
 
+        return forward ( 1 );
       }
+#endif
 
-    for ( int i {n_layers-2}; i >0 ; --i )
+    units[0] = image;
+
+#ifndef CUDA_PRCPS
+    if ( active.sparse )
       {
+        spgemv ( weights[0], padded ( n_units[0] ), n_units[1],
+                 active.idx.data(), active.val.data(), active.idx.size(), units[1] );
 
-        #pragma omp parallel for
-        for ( int j =0; j < n_units[i]; ++j )
-          {
+        logistic ( units[1], units[1], n_units[1] );
 
-            double sum = 0.0;
+        return forward ( 2 );
+      }
+#endif
 
-            for ( int l = 0; l < n_units[i+1]; ++l )
-              {
-                sum += 0.19*weights[i][l][j]*backs[i][l];
-              }
+    return forward ( 1 );
 
-            backs[i-1][j] = sigmoid ( units[i][j] ) * ( 1.0-sigmoid ( units[i][j] ) ) * sum;
+  }
 
-            for ( int k = 0; k < n_units[i-1]; ++k )
-              {
-                weights[i-1][j][k] += ( 0.19* backs[i-1][j] *units[i-1][k] );
-              }
+  // The Q value computed on the same image (the same stamp) is reused
+  // until the perceptron learns.
+  double operator() ( Real image [], const ActiveInputs & active, unsigned long stamp )
+  {
+    if ( stamp != memo_stamp || revision() != memo_version )
+      {
+#ifdef TRUNK_PRCPS
+        if ( trunk )
+          {
+            // the hidden units of the image are computed once by the trunk
+            ( *trunk ) ( image, active, stamp );
+            units[0] = trunk->top();
+
+            memo_q = forward ( 1 );
           }
-      }
+        else
+#endif
+          memo_q = ( *this ) ( image, active );
 
-    for ( int i {0}; i < n_layers-1; ++i )
-      {
-        delete [] backs[i];
+        memo_stamp = stamp;
+        memo_version = revision();
       }
 
-    delete [] backs;
-
+    return memo_q;
   }
 
-  ~Perceptron()
+#ifdef INT8_PRCPS
+  // Forward pass on the int8 copy of the weights. The copy is refreshed
+  // from the master weights if they have learnt since it was made.
+  double operator() ( const QuantizedInputs & image )
   {
+
+    if ( qversion != version )
+      quantize();
+
+    const int8_t * x = image.q.data();
+    float scale = image.scale;
+
     for ( int i {1}; i < n_layers; ++i )
       {
+        qgemv ( qrow ( i-1, 0 ), qpadded ( n_units[i-1] ), n_units[i], x, n_units[i-1], qacc.data() );
+
         for ( int j {0}; j < n_units[i]; ++j )
           {
-            delete [] weights[i-1][j];
+            units[i][j] = qacc[j] * qscales[i-1] * scale;
           }
 
-        delete [] weights[i-1];
-      }
+        logistic ( units[i], units[i], n_units[i] );
 
-    delete [] weights;
+        // the activations of the hidden layers are in (0, 1)
+        if ( i < n_layers-1 )
+          {
+            for ( int j {0}; j < n_units[i]; ++j )
+              {
+                qunits[j] = static_cast<int8_t> ( std::lround ( units[i][j] * 127 ) );
+              }
 
-    for ( int i {0}; i < n_layers; ++i )
-      {
-        if ( i )
-          delete [] units[i];
+            x = qunits.data();
+            scale = 1.0f / 127;
+          }
       }
 
-    delete [] units;
-    delete [] n_units;
+    return sigmoid ( units[n_layers - 1][0] );
 
   }
 
-  void save ( std::fstream & out )
+  // per-layer symmetric quantization of the weights
+  void quantize ( void )
   {
-    out << " "
-        << n_layers;
+    if ( qoffsets.empty() )
+      {
+        std::size_t size {0};
+        int max_units {0};
 
-    for ( int i {0}; i < n_layers; ++i )
-      out << " " << n_units[i];
+        for ( int i {1}; i < n_layers; ++i )
+          {
+            qoffsets.push_back ( size );
+            size += n_units[i] * qpadded ( n_units[i-1] );
+            max_units = std::max ( max_units, n_units[i] );
+          }
+
+        qweights.resize ( size );
+        qscales.resize ( n_layers-1 );
+        qunits.resize ( max_units );
+        qacc.resize ( max_units );
+      }
 
     for ( int i {1}; i < n_layers; ++i )
       {
+        Real m {0};
+
         for ( int j {0}; j < n_units[i]; ++j )
           {
+            Real * w = row ( i-1, j );
+
             for ( int k {0}; k < n_units[i-1]; ++k )
-              {
-                out << " "
-                    << weights[i-1][j][k];
+              m = std::max ( m, std::fabs ( w[k] ) );
+          }
 
-              }
+        qscales[i-1] = m > 0 ? m / 127.0f : 1.0f;
+
+        for ( int j {0}; j < n_units[i]; ++j )
+          {
+            Real * w = row ( i-1, j );
+            int8_t * q = qrow ( i-1, j );
+
+            for ( int k {0}; k < n_units[i-1]; ++k )
+              q[k] = static_cast<int8_t> ( std::lround ( w[k] / qscales[i-1] ) );
           }
       }
 
+    qversion = version;
   }
+#endif
 
-private:
-  Perceptron ( const Perceptron & );
-  Perceptron & operator= ( const Perceptron & );
+#ifdef FUSED_PRCPS
+  // Completes a forward pass whose first layer (before the activation)
+  // has already been computed by a PerceptronStack.
+  double operator() ( Real image [], const Real hidden [] )
+  {
 
-  int n_layers;
-  int* n_units;
-  double **units;
-  double ***weights;
+    units[0] = image;
 
-};
-#endif
+    logistic ( units[1], hidden, n_units[1] );
 
-#ifdef FEELINGS
-typedef std::string Feeling;
+    return forward ( 2 );
+
+  }
 #endif
 
-class QL
-{
-public:
-  QL (int nrows)
+  double forward ( int from )
   {
-#ifdef FEELINGS
-    std::random_device init;
-    std::default_random_engine gen {init() };
-    //std::uniform_int_distribution<int> dist ( 0, 1 );
-    //std::uniform_int_distribution<int> dist ( 0, 6 );
-    std::uniform_int_distribution<int> dist ( 0, 9 );
-    //std::uniform_int_distribution<int> dist (48, 126 );
-    for ( int i {0}; i<nrows; ++i )
+    // the units no longer belong to the memoized image
+    memo_stamp = 0;
+
+    for ( int i {from}; i < n_layers; ++i )
       {
-        std::stringstream ss;
-        for ( int j {0}; j<10; ++j )
+
+#ifdef CUDA_PRCPS
+
+        cuda_layer ( i, n_units, units, weights[i-1], padded ( n_units[i-1] ) );
+
+#else
+
+#ifndef POOL_PRCPS
+        #pragma omp parallel for
+#endif
+        for ( int j = 0; j < n_units[i]; j += 4 )
           {
-            //char c = dist ( gen );
-            //ss << c;
-            ss << dist ( gen );
+            int rows = std::min ( 4, n_units[i] - j );
+
+            gemv ( row ( i-1, j ), padded ( n_units[i-1] ), rows, units[i-1], n_units[i-1], units[i] + j );
+
           }
-        prcps_f[ss.str()] = new Perceptron ( 3, 10*80, 16,  1 ); //exp.a1 // 302
-      }
+
+        logistic ( units[i], units[i], n_units[i] );
+
 #endif
+
+      }
+
+    return sigmoid ( units[n_layers - 1][0] );
+
   }
 
-  QL ( SPOTriplet triplet )
-  {}
+  void learning ( Real image [], double q, double prev_q, const ActiveInputs * active = nullptr )
+  {
+    double y[1] {q};
 
-  ~QL()
+    learning ( image, y, active );
+  }
+
+  // With the non-zero inputs of the image only their columns of the first
+  // layer are updated, the others would get zero.
+  void learning ( Real image [], double y[], const ActiveInputs * active = nullptr )
   {
-#ifndef Q_LOOKUP_TABLE
-    for ( std::map<SPOTriplet, Perceptron*>::iterator it=prcps.begin(); it!=prcps.end(); ++it )
+    //( *this ) ( image );
+
+#ifdef TRUNK_PRCPS
+    units[0] = trunk ? trunk->top() : image;
+    const ActiveInputs * inputs = trunk ? nullptr : active;
+#else
+    units[0] = image;
+    const ActiveInputs * inputs = active;
+#endif
+
+    int i {n_layers-1};
+
+    // the slope sigmoid(u)*(1-sigmoid(u)) is taken at the activations u,
+    // the sigmoids of a layer are computed at once into its deltas
+    logistic ( backs[i-1], units[i], n_units[i] );
+
+    for ( int j {0}; j < n_units[i]; ++j )
+      {
+        double s = backs[i-1][j];
+        backs[i-1][j] = s * ( 1.0-s ) * ( y[j] - units[i][j] );
+
+        update ( i-1, j, 0.2, inputs );
+
+      }
+
+    for ( int i {n_layers-2}; i >0 ; --i )
+      {
+        hidden_learning ( i, weights[i], padded ( n_units[i] ), backs[i], n_units[i+1], inputs );
+      }
+
+#ifdef TRUNK_PRCPS
+    if ( trunk )
+      trunk->learning ( *this, active );
+#endif
+
+    ++version;
+
+  }
+
+#ifdef TRUNK_PRCPS
+  // Backpropagation from a head into the trunk, the top layer of the trunk
+  // is the input layer of the head.
+  void learning ( const Perceptron & head, const ActiveInputs * active = nullptr )
+  {
+    hidden_learning ( n_layers-1, head.weights[0], padded ( head.n_units[0] ), head.backs[0], head.n_units[1], active );
+
+    for ( int i {n_layers-2}; i >0 ; --i )
+      {
+        hidden_learning ( i, weights[i], padded ( n_units[i] ), backs[i], n_units[i+1], active );
+      }
+
+    ++version;
+  }
+#endif
+
+  // Mini-batch learning: the forward and the backward passes are computed
+  // for the n images together, layer by layer, so a block of weight rows is
+  // reused by all of them, and the weights get the mean of the updates of
+  // learning() at once. targets holds the targets of the images one after
+  // the other. With n = 1 it is the same as a forward pass and learning().
+  void learning_batch ( Real * images [], const double targets [], int n )
+  {
+#ifdef TRUNK_PRCPS
+    if ( trunk )
+      throw "Mini-batch learning of heads is not supported.";
+#endif
+
+    batch ( n );
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        int in = padded ( n_units[i-1] ), out = padded ( n_units[i] );
+
+#ifndef POOL_PRCPS
+        #pragma omp parallel for
+#endif
+        for ( int j = 0; j < n_units[i]; j += 4 )
+          {
+            int rows = std::min ( 4, n_units[i] - j );
+
+            for ( int b = 0; b < n; ++b )
+              {
+                const Real * x = i == 1 ? images[b] : batch_units[i-1] + b*in;
+                gemv ( row ( i-1, j ), in, rows, x, n_units[i-1], batch_units[i] + b*out + j );
+              }
+          }
+
+        for ( int b {0}; b < n; ++b )
+          {
+            logistic ( batch_units[i] + b*out, batch_units[i] + b*out, n_units[i] );
+          }
+      }
+
+    for ( int i {n_layers-1}; i > 0; --i )
+      {
+        int in = padded ( n_units[i-1] ), out = padded ( n_units[i] );
+        double rate = i == n_layers-1 ? 0.2 : 0.19;
+
+        for ( int b {0}; b < n; ++b )
+          {
+            logistic ( batch_backs[i-1] + b*out, batch_units[i] + b*out, n_units[i] );
+          }
+
+#ifndef POOL_PRCPS
+        #pragma omp parallel for
+#endif
+        for ( int j = 0; j < n_units[i]; ++j )
+          {
+            Real * w = row ( i-1, j );
+
+            for ( int b = 0; b < n; ++b )
+              {
+                Real * back = batch_backs[i-1] + b*out + j;
+                double s = *back;
+
+                if ( i == n_layers-1 )
+                  {
+                    *back = s * ( 1.0-s ) * ( targets[b*n_units[i] + j] - batch_units[i][b*out + j] );
+                  }
+                else
+                  {
+                    double sum = 0.0;
+
+                    for ( int l = 0; l < n_units[i+1]; ++l )
+                      {
+                        sum += 0.19*row ( i, l ) [j]*batch_backs[i][b*padded ( n_units[i+1] ) + l];
+                      }
+
+                    *back = s * ( 1.0-s ) * sum;
+                  }
+              }
+
+            // the update of the row is applied four images at a time
+            int b = 0;
+            for ( ; b + 4 <= n; b += 4 )
+              {
+                const Real * x0 = i == 1 ? images[b] : batch_units[i-1] + b*in;
+                const Real * x1 = i == 1 ? images[b+1] : x0 + in;
+                const Real * x2 = i == 1 ? images[b+2] : x0 + 2*in;
+                const Real * x3 = i == 1 ? images[b+3] : x0 + 3*in;
+                Real c0 = rate * batch_backs[i-1][b*out + j] / n;
+                Real c1 = rate * batch_backs[i-1][ ( b+1 ) *out + j] / n;
+                Real c2 = rate * batch_backs[i-1][ ( b+2 ) *out + j] / n;
+                Real c3 = rate * batch_backs[i-1][ ( b+3 ) *out + j] / n;
+
+                for ( int k = 0; k < n_units[i-1]; ++k )
+                  {
+                    w[k] += c0 * x0[k] + c1 * x1[k] + c2 * x2[k] + c3 * x3[k];
+                  }
+              }
+
+            for ( ; b < n; ++b )
+              {
+                const Real * x = i == 1 ? images[b] : batch_units[i-1] + b*in;
+                double c = rate * batch_backs[i-1][b*out + j] / n;
+
+                for ( int k = 0; k < n_units[i-1]; ++k )
+                  {
+                    w[k] += c * x[k];
+                  }
+              }
+          }
+      }
+
+    ++version;
+
+  }
+
+  ~Perceptron()
+  {
+    dealloc();
+  }
+
+  // the bytes of the weights, the units and the deltas
+  std::size_t footprint ( void ) const
+  {
+    std::size_t n {0};
+
+    for ( int i {1}; i < n_layers; ++i )
+      n += 2 * padded ( n_units[i] );
+
+    return ( n + n_weights() ) * sizeof ( Real );
+  }
+
+  // takes the weights of a perceptron of the same topology
+  void assign ( const Perceptron & p )
+  {
+    if ( p.n_layers != n_layers || !std::equal ( n_units, n_units + n_layers, p.n_units ) )
+      throw "The topologies of the perceptrons must agree.";
+
+    std::memcpy ( weights[0], p.weights[0], n_weights() * sizeof ( Real ) );
+
+    ++version;
+  }
+
+  // the weight rows are written as they are in the memory
+  void save ( SoulWriter & out ) const
+  {
+    out.put<uint32_t> ( n_layers );
+
+    for ( int i {0}; i < n_layers; ++i )
+      out.put<uint32_t> ( n_units[i] );
+
+    out.align();
+
+    out.write ( weights[0], n_weights() * sizeof ( Real ) );
+  }
+
+  void save ( std::fstream & out )
+  {
+    out << " "
+        << n_layers;
+
+    for ( int i {0}; i < n_layers; ++i )
+      out << " " << n_units[i];
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        for ( int j {0}; j < n_units[i]; ++j )
+          {
+            Real * w = row ( i-1, j );
+
+            for ( int k {0}; k < n_units[i-1]; ++k )
+              {
+                out << " "
+                    << w[k];
+
+              }
+          }
+      }
+
+  }
+
+private:
+  Perceptron ( const Perceptron & );
+  Perceptron & operator= ( const Perceptron & );
+
+#ifdef FUSED_PRCPS
+  friend class PerceptronStack;
+#endif
+
+  // All the layers of a perceptron live in one cache line aligned block,
+  // units first, then the weight matrices of the layers in row-major order,
+  // and last the deltas of the backpropagation, so learning does not
+  // allocate. Each row is padded to a whole number of cache lines.
+  static const int align = 64;
+
+  // the weights of a new perceptron are drawn from [-1, 1], with RND_DEBUG
+  // all the perceptrons of a topology start from the same weights
+  void randomize ( void )
+  {
+    alloc();
+
+#ifndef RND_DEBUG
+    std::random_device init;
+    std::default_random_engine gen {init() };
+#else
+    std::default_random_engine gen;
+#endif
+
+    std::uniform_real_distribution<double> dist ( -1.0, 1.0 );
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        for ( int j {0}; j < n_units[i]; ++j )
+          {
+            Real * w = row ( i-1, j );
+
+            for ( int k {0}; k < n_units[i-1]; ++k )
+              {
+                w[k] = dist ( gen );
+              }
+          }
+      }
+  }
+
+  static int padded ( int n )
+  {
+    const int m = align / sizeof ( Real );
+
+    return ( ( n + m - 1 ) / m ) * m;
+  }
+
+  Real * row ( int l, int j )
+  {
+    return weights[l] + j * padded ( n_units[l] );
+  }
+
+  // the weight matrices follow each other in the arena
+  std::size_t n_weights ( void ) const
+  {
+    std::size_t n {0};
+
+    for ( int i {1}; i < n_layers; ++i )
+      n += n_units[i] * padded ( n_units[i-1] );
+
+    return n;
+  }
+
+  // deltas and weight update of the hidden layer i from the layer above
+  // it, given by its weights (rows stride apart) and its n_up deltas
+  void hidden_learning ( int i, const Real * up, int stride, const Real * up_backs, int n_up,
+                         const ActiveInputs * active = nullptr )
+  {
+    logistic ( backs[i-1], units[i], n_units[i] );
+
+#ifndef POOL_PRCPS
+    #pragma omp parallel for
+#endif
+    for ( int j =0; j < n_units[i]; ++j )
+      {
+
+        double sum = 0.0;
+
+        for ( int l = 0; l < n_up; ++l )
+          {
+            sum += 0.19*up[l*stride + j]*up_backs[l];
+          }
+
+        double s = backs[i-1][j];
+        backs[i-1][j] = s * ( 1.0-s ) * sum;
+
+        update ( i-1, j, 0.19, active );
+      }
+  }
+
+  // w += rate * delta * x on the row j of the weights of the layer l, on
+  // the input layer of a sparse image only at its non-zero inputs
+  void update ( int l, int j, double rate, const ActiveInputs * active )
+  {
+    Real * w = row ( l, j );
+
+    if ( l == 0 && active && active->sparse )
+      {
+        const int * idx = active->idx.data();
+        const Real * val = active->val.data();
+        int n = active->idx.size();
+
+        for ( int a = 0; a < n; ++a )
+          {
+            w[idx[a]] += ( rate* backs[l][j] *val[a] );
+          }
+
+        return;
+      }
+
+    for ( int k = 0; k < n_units[l]; ++k )
+      {
+        w[k] += ( rate* backs[l][j] *units[l][k] );
+      }
+  }
+
+  // it changes whenever the Q values of the perceptron may change
+  unsigned long revision ( void ) const
+  {
+#ifdef TRUNK_PRCPS
+    if ( trunk )
+      return version + trunk->version;
+#endif
+
+    return version;
+  }
+
+#ifdef TRUNK_PRCPS
+  Real * top ( void ) const
+  {
+    return units[n_layers-1];
+  }
+#endif
+
+#ifdef INT8_PRCPS
+  static int qpadded ( int n )
+  {
+    return ( ( n + align - 1 ) / align ) * align;
+  }
+
+  int8_t * qrow ( int l, int j )
+  {
+    return qweights.data() + qoffsets[l] + j * qpadded ( n_units[l] );
+  }
+#endif
+
+  // the weights are placed in the arena unless they are mapped from a soul
+  void alloc ( Real * mapped = nullptr )
+  {
+    units = new Real*[n_layers];
+    weights = new Real*[n_layers-1];
+    backs = new Real*[n_layers-1];
+
+    std::size_t size {0};
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        size += 2 * padded ( n_units[i] );
+
+        if ( !mapped )
+          size += n_units[i] * padded ( n_units[i-1] );
+      }
+
+    void * p;
+    if ( posix_memalign ( &p, align, size * sizeof ( Real ) ) )
+      throw std::bad_alloc();
+
+    arena = static_cast<Real*> ( p );
+    std::memset ( arena, 0, size * sizeof ( Real ) );
+
+    Real * a = arena;
+
+    units[0] = nullptr;
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        units[i] = a;
+        a += padded ( n_units[i] );
+      }
+
+    Real * w = mapped ? mapped : a;
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        weights[i-1] = w;
+        w += n_units[i] * padded ( n_units[i-1] );
+      }
+
+    if ( !mapped )
+      a = w;
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        backs[i-1] = a;
+        a += padded ( n_units[i] );
+      }
+  }
+
+  void dealloc ( void )
+  {
+    free ( arena );
+
+    delete [] backs;
+    delete [] weights;
+    delete [] units;
+    delete [] n_units;
+  }
+
+  // releases the memory of a perceptron whose constructor throws after
+  // alloc(), its destructor is not called
+  struct Dealloc
+  {
+    void operator() ( Perceptron * p ) const
+    {
+      p->dealloc();
+    }
+  };
+
+  // the units and the deltas of the images of learning_batch, the memory
+  // is only reallocated for a larger batch
+  void batch ( int n )
+  {
+    std::size_t size {0};
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        size += 2 * n * padded ( n_units[i] );
+      }
+
+    if ( batch_arena.size() < size )
+      batch_arena.resize ( size );
+
+    batch_units.resize ( n_layers );
+    batch_backs.resize ( n_layers-1 );
+
+    Real * a = batch_arena.data();
+
+    for ( int i {1}; i < n_layers; ++i )
+      {
+        batch_units[i] = a;
+        a += n * padded ( n_units[i] );
+        batch_backs[i-1] = a;
+        a += n * padded ( n_units[i] );
+      }
+  }
+
+  int n_layers;
+  int* n_units;
+  Real **units;
+  Real **weights;
+  Real **backs;
+  Real *arena;
+
+  // It is incremented by each learning step.
+  unsigned long version {0};
+
+  std::vector<Real> batch_arena;
+  std::vector<Real*> batch_units;
+  std::vector<Real*> batch_backs;
+
+#ifdef TRUNK_PRCPS
+  Perceptron * trunk {nullptr};
+#endif
+
+  double memo_q {0.0};
+  unsigned long memo_stamp {0};
+  unsigned long memo_version {0};
+
+#ifdef INT8_PRCPS
+  std::vector<int8_t> qweights;
+  std::vector<std::size_t> qoffsets;
+  std::vector<float> qscales;
+  std::vector<int8_t> qunits;
+  std::vector<int32_t> qacc;
+  unsigned long qversion {~0ul};
+#endif
+
+};
+
+#ifdef FUSED_PRCPS
+#ifdef CUDA_PRCPS
+#error "FUSED_PRCPS is a CPU only evaluation mode"
+#endif
+
+// The first layers of all the action perceptrons are stacked into one matrix,
+// so a single GEMV pass over the image computes the hidden units of every action
+// and then the output layers are evaluated from this block action by action.
+// The stacked rows are copies, a slot is refreshed when its perceptron has learnt.
+class PerceptronStack
+{
+public:
+  PerceptronStack()
+  {}
+
+  ~PerceptronStack()
+  {
+    free ( stack );
+  }
+
+  int add ( Perceptron * p )
+  {
+    if ( prcps.empty() )
+      {
+        n_in = p->n_units[0];
+        n_hidden = p->n_units[1];
+        stride = Perceptron::padded ( n_in );
+      }
+
+    if ( p->n_units[0] != n_in || p->n_units[1] != n_hidden )
+      throw "The topologies of stacked perceptrons must agree.";
+
+    if ( prcps.size() == capacity )
+      grow();
+
+    slots[p] = prcps.size();
+    prcps.push_back ( p );
+    versions.push_back ( ~0ul );
+
+    return prcps.size()-1;
+  }
+
+  // q takes the slot of p, its rows are copied at the next sync
+  void replace ( Perceptron * p, Perceptron * q )
+  {
+    if ( q->n_units[0] != n_in || q->n_units[1] != n_hidden )
+      throw "The topologies of stacked perceptrons must agree.";
+
+    int a = slots[p];
+
+    slots.erase ( p );
+    slots[q] = a;
+    prcps[a] = q;
+    versions[a] = ~0ul;
+  }
+
+  // the last perceptron moves into the slot of p, its rows are copied at
+  // the next sync
+  void remove ( Perceptron * p )
+  {
+    int a = slots[p];
+    Perceptron * last = prcps.back();
+
+    slots.erase ( p );
+    if ( last != p )
+      {
+        slots[last] = a;
+        prcps[a] = last;
+        versions[a] = ~0ul;
+      }
+
+    prcps.pop_back();
+    versions.pop_back();
+    stamp = 0;
+  }
+
+  int slot ( Perceptron * p )
+  {
+    return slots[p];
+  }
+
+  int size ( void ) const
+  {
+    return prcps.size();
+  }
+
+  // q[slot] = Q value of the perceptron in that slot, on a repeated stamp
+  // only the perceptrons that have learnt since are evaluated again
+  void operator() ( Real image [], const ActiveInputs & active, std::vector<double> & q, unsigned long stamp )
+  {
+    if ( stamp == this->stamp && q.size() == prcps.size() )
+      {
+        for ( std::size_t a {0}; a < prcps.size(); ++a )
+          {
+            q[a] = ( *prcps[a] ) ( image, active, stamp );
+          }
+
+        return;
+      }
+
+    sync();
+
+    int n = prcps.size();
+
+    q.resize ( n );
+    hidden.resize ( n * n_hidden );
+
+    if ( active.sparse )
+      spgemv ( stack, stride, n * n_hidden, active.idx.data(), active.val.data(), active.idx.size(), hidden.data() );
+    else
+      gemv ( stack, stride, n * n_hidden, image, n_in, hidden.data() );
+
+    for ( int a {0}; a < n; ++a )
+      {
+        q[a] = ( *prcps[a] ) ( image, hidden.data() + a * n_hidden );
+
+        prcps[a]->memo_q = q[a];
+        prcps[a]->memo_stamp = stamp;
+        prcps[a]->memo_version = prcps[a]->version;
+      }
+
+    this->stamp = stamp;
+  }
+
+private:
+  PerceptronStack ( const PerceptronStack & );
+  PerceptronStack & operator= ( const PerceptronStack & );
+
+  void sync ( void )
+  {
+    for ( std::size_t a {0}; a < prcps.size(); ++a )
+      {
+        if ( versions[a] == prcps[a]->version )
+          continue;
+
+        for ( int j {0}; j < n_hidden; ++j )
+          {
+            std::memcpy ( stack + ( a * n_hidden + j ) * stride, prcps[a]->row ( 0, j ), n_in * sizeof ( Real ) );
+          }
+
+        versions[a] = prcps[a]->version;
+      }
+  }
+
+  void grow ( void )
+  {
+    std::size_t new_capacity = capacity ? 2 * capacity : 64;
+    std::size_t size = new_capacity * n_hidden * stride * sizeof ( Real );
+
+    void * p;
+    if ( posix_memalign ( &p, Perceptron::align, size ) )
+      throw std::bad_alloc();
+
+    std::memset ( p, 0, size );
+
+    if ( stack )
+      {
+        std::memcpy ( p, stack, capacity * n_hidden * stride * sizeof ( Real ) );
+        free ( stack );
+      }
+
+    stack = static_cast<Real*> ( p );
+    capacity = new_capacity;
+  }
+
+  int n_in {0};
+  int n_hidden {0};
+  int stride {0};
+  unsigned long stamp {0};
+  std::size_t capacity {0};
+  Real *stack {nullptr};
+  std::vector<Perceptron*> prcps;
+  std::vector<unsigned long> versions;
+  std::map<Perceptron*, int> slots;
+  std::vector<Real> hidden;
+
+};
+#endif
+#endif
+
+#ifdef WARM_PRCPS
+// A background thread keeps depth freshly initialised perceptrons ready for
+// each topology asked for, so a new action does not wait for the random
+// draws of its weights. A topology is learnt at its first request, which
+// is served in place, just as an empty pool. With RND_DEBUG the pooled
+// perceptrons have the same weights as the ones made in place.
+class PerceptronPool
+{
+public:
+  PerceptronPool ( std::size_t depth = 4 ) : depth ( depth )
+  {
+    worker = std::thread ( &PerceptronPool::work, this );
+  }
+
+  ~PerceptronPool()
+  {
+    {
+      std::unique_lock<std::mutex> lock ( mutex );
+      stop = true;
+    }
+    wake.notify_all();
+
+    worker.join();
+
+    for ( auto & ready : pools )
+      for ( Perceptron * p : ready.second )
+        delete p;
+  }
+
+  Perceptron * operator() ( const std::vector<int> & topology )
+  {
+    Perceptron * p {nullptr};
+
+    {
+      std::unique_lock<std::mutex> lock ( mutex );
+      std::vector<Perceptron*> & ready = pools[topology];
+
+      if ( !ready.empty() )
+        {
+          p = ready.back();
+          ready.pop_back();
+        }
+    }
+    wake.notify_all();
+
+    return p ? p : new Perceptron ( topology );
+  }
+
+private:
+  PerceptronPool ( const PerceptronPool & );
+  PerceptronPool & operator= ( const PerceptronPool & );
+
+  void work ( void )
+  {
+    std::unique_lock<std::mutex> lock ( mutex );
+
+    for ( ;; )
+      {
+        std::map<std::vector<int>, std::vector<Perceptron*>>::iterator it = pools.begin();
+        while ( it != pools.end() && it->second.size() >= depth )
+          ++it;
+
+        if ( stop )
+          return;
+
+        if ( it == pools.end() )
+          {
+            wake.wait ( lock );
+            continue;
+          }
+
+        std::vector<int> topology = it->first;
+
+        // the weights are drawn outside of the lock
+        lock.unlock();
+        Perceptron * p = new Perceptron ( topology );
+        lock.lock();
+
+        pools[topology].push_back ( p );
+      }
+  }
+
+  std::size_t depth;
+  std::map<std::vector<int>, std::vector<Perceptron*>> pools;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stop {false};
+  std::thread worker;
+};
+#endif
+
+#ifdef REPLAY_PRCPS
+// A transition of the experience replay: the images of the state and of the
+// next state in int8, the action taken, the fingerprint of the state (for its
+// visits) and the reward got. The target of its TD update is computed again
+// with the current weights when it is replayed.
+struct Transition
+{
+  QuantizedInputs image;
+  int action;
+  uint64_t state;
+  double reward;
+  QuantizedInputs next;
+};
+
+// The last transitions in a ring, the oldest one is overwritten. The slots
+// keep their images, so a full ring records without allocation.
+class ReplayBuffer
+{
+public:
+  explicit ReplayBuffer ( std::size_t capacity ) : ring ( capacity )
+  {}
+
+  void push ( const Real image [], int action, uint64_t state, double reward, const Real next_image [], int n )
+  {
+    Transition & t = ring[next];
+
+    t.image ( image, n );
+    t.action = action;
+    t.state = state;
+    t.reward = reward;
+    t.next ( next_image, n );
+
+    next = ( next + 1 ) % ring.size();
+    count = std::min ( count + 1, ring.size() );
+  }
+
+  std::size_t size ( void ) const
+  {
+    return count;
+  }
+
+  // a transition drawn uniformly
+  template <typename G>
+  const Transition & sample ( G & gen ) const
+  {
+    return ring[std::uniform_int_distribution<std::size_t> ( 0, count - 1 ) ( gen )];
+  }
+
+private:
+  std::vector<Transition> ring;
+  std::size_t next {0};
+  std::size_t count {0};
+};
+#endif
+
+// The triplets are interned, a triplet gets a dense integer ID when it is
+// first seen and keeps it for the whole run. The per-action structures of
+// QL are vectors indexed by these IDs, the text of a triplet is needed only
+// to show and to save it. Like QL, it is used from one thread.
+class TripletIds
+{
+public:
+  static TripletIds & get ( void )
+  {
+    static TripletIds dictionary;
+
+    return dictionary;
+  }
+
+  int operator() ( const SPOTriplet & triplet )
+  {
+    key.assign ( triplet.s );
+    key.push_back ( '\0' );
+    key.append ( triplet.p );
+    key.push_back ( '\0' );
+    key.append ( triplet.o );
+
+    std::unordered_map<std::string, int>::iterator it = ids.find ( key );
+    if ( it != ids.end() )
+      return it->second;
+
+    int id = triplets.size();
+    ids.emplace ( key, id );
+    triplets.push_back ( triplet );
+
+    return id;
+  }
+
+  const SPOTriplet & operator[] ( int id ) const
+  {
+    return triplets[id];
+  }
+
+  // the order of the triplets as SPOTriplet keys had it
+  bool less ( int a, int b ) const
+  {
+    return triplets[a] < triplets[b];
+  }
+
+private:
+  TripletIds() {}
+  TripletIds ( const TripletIds & );
+  TripletIds & operator= ( const TripletIds & );
+
+  std::unordered_map<std::string, int> ids;
+  std::deque<SPOTriplet> triplets;
+  std::string key;
+};
+
+// The states are the programs of the visual imagery, QL knows them by
+// their 64-bit FNV-1a fingerprints. A fingerprint is extended piece by
+// piece as a program is put together, fingerprint ( b, fingerprint ( a ) )
+// is the fingerprint of a+b.
+static const uint64_t empty_state {14695981039346656037ull};
+
+inline uint64_t fingerprint ( const std::string & text, uint64_t state = empty_state )
+{
+  for ( std::string::const_iterator it=text.begin(); it!=text.end(); ++it )
+    {
+      state ^= static_cast<unsigned char> ( *it );
+      state *= 1099511628211ull;
+    }
+
+  return state;
+}
+
+// The visit counts of the (action, state) pairs in one open addressing
+// hash table with linear probing, keyed by the ID of the action and the
+// fingerprint of the state. A pair that is missing has no visits, reading
+// it does not insert it. The sums of the counts by action are kept for the
+// eviction and the pruning.
+//
+// The scaling is lazy: the factors are logged and every count is stamped
+// with the length of the log when it was last brought up to date. The
+// factors logged after its stamp are applied to a count when it is
+// accessed, one by one with the truncation of the eager scaling. The log is
+// folded into all the counts when it grows as long as the table has pairs,
+// so a scaling costs O(1) amortized. The sums are scaled as wholes, they can be
+// a little above the sums of the truncated counts.
+//
+// The pairs added or set since the last untouch are listed, a delta of the
+// soul holds only their counts.
+class VisitTable
+{
+public:
+  struct Entry
+  {
+    uint64_t state;
+    // -1 in a free slot
+    int action;
+    int n;
+    uint32_t epoch;
+    bool touched;
+  };
+
+  VisitTable() : slots ( 1024, Entry {0, -1, 0, 0, false} )
+  {}
+
+  int get ( int action, uint64_t state ) const
+  {
+    Entry & e = slots[find ( action, state )];
+
+    return e.action == action ? count ( e ) : 0;
+  }
+
+  // adds to the count of the pair, it returns the new count
+  int add ( int action, uint64_t state, int n = 1 )
+  {
+    Entry & e = insert ( action, state );
+
+    count ( e ) += n;
+    sum ( action ) += n;
+    touch ( e );
+
+    return e.n;
+  }
+
+  void set ( int action, uint64_t state, int n )
+  {
+    Entry & e = insert ( action, state );
+
+    sum ( action ) += n - count ( e );
+    e.n = n;
+    touch ( e );
+  }
+
+  // all the counts are scaled, the pairs are kept even at zero
+  void scale ( double s )
+  {
+    factors.push_back ( s );
+
+    if ( factors.size() >= std::max ( used, std::size_t {64} ) )
+      fold();
+  }
+
+  long total ( int action ) const
+  {
+    return action >= 0 && action < ( int ) totals.size() ? sum ( action ) : 0;
+  }
+
+  // f ( action, state, n ) for all the pairs
+  template <typename F>
+  void for_each ( F f ) const
+  {
+    for ( std::vector<Entry>::iterator it=slots.begin(); it!=slots.end(); ++it )
+      if ( it->action >= 0 )
+        f ( it->action, it->state, count ( *it ) );
+  }
+
+  // f ( action, state, n ) for the pairs touched since the last untouch
+  template <typename F>
+  void for_each_touched ( F f ) const
+  {
+    for ( std::vector<std::pair<int, uint64_t>>::const_iterator it=touched.begin(); it!=touched.end(); ++it )
+      f ( it->first, it->second, get ( it->first, it->second ) );
+  }
+
+  bool untouched ( void ) const
+  {
+    return touched.empty();
+  }
+
+  void untouch ( void )
+  {
+    for ( std::vector<std::pair<int, uint64_t>>::iterator it=touched.begin(); it!=touched.end(); ++it )
+      slots[find ( it->first, it->second )].touched = false;
+
+    touched.clear();
+  }
+
+  int actions ( void ) const
+  {
+    return std::count_if ( pairs.begin(), pairs.end(), [] ( int n )
+    {
+      return n > 0;
+    } );
+  }
+
+private:
+  void touch ( Entry & e )
+  {
+    if ( !e.touched )
+      {
+        e.touched = true;
+        touched.push_back ( std::make_pair ( e.action, e.state ) );
+      }
+  }
+
+  // the count brought up to date
+  int & count ( Entry & e ) const
+  {
+    for ( ; e.epoch < factors.size() && e.n; ++e.epoch )
+      e.n *= factors[e.epoch];
+    e.epoch = factors.size();
+
+    return e.n;
+  }
+
+  long & sum ( int action ) const
+  {
+    long & n = totals[action];
+
+    for ( uint32_t & epoch = total_epochs[action]; epoch < factors.size(); ++epoch )
+      n *= factors[epoch];
+
+    return n;
+  }
+
+  // the logged factors are applied to all the counts
+  void fold ( void )
+  {
+    for ( std::vector<Entry>::iterator it=slots.begin(); it!=slots.end(); ++it )
+      if ( it->action >= 0 )
+        count ( *it );
+
+    for ( std::size_t a {0}; a < totals.size(); ++a )
+      sum ( a );
+
+    factors.clear();
+
+    for ( std::vector<Entry>::iterator it=slots.begin(); it!=slots.end(); ++it )
+      it->epoch = 0;
+
+    std::fill ( total_epochs.begin(), total_epochs.end(), 0 );
+  }
+
+  std::size_t find ( int action, uint64_t state ) const
+  {
+    std::size_t mask = slots.size() - 1;
+    std::size_t i = hash ( action, state ) & mask;
+
+    while ( slots[i].action >= 0 && ( slots[i].action != action || slots[i].state != state ) )
+      i = ( i + 1 ) & mask;
+
+    return i;
+  }
+
+  Entry & insert ( int action, uint64_t state )
+  {
+    std::size_t i = find ( action, state );
+
+    if ( slots[i].action < 0 )
+      {
+        // at most half full
+        if ( 2 * ( used + 1 ) > slots.size() )
+          {
+            grow();
+            i = find ( action, state );
+          }
+
+        slots[i] = Entry {state, action, 0, static_cast<uint32_t> ( factors.size() ), false};
+        ++used;
+
+        if ( action >= ( int ) pairs.size() )
+          {
+            pairs.resize ( action + 1, 0 );
+            totals.resize ( action + 1, 0 );
+            total_epochs.resize ( action + 1, factors.size() );
+          }
+        ++pairs[action];
+      }
+
+    return slots[i];
+  }
+
+  void grow ( void )
+  {
+    std::vector<Entry> old ( 2 * slots.size(), Entry {0, -1, 0, 0, false} );
+    old.swap ( slots );
+
+    for ( std::vector<Entry>::iterator it=old.begin(); it!=old.end(); ++it )
+      if ( it->action >= 0 )
+        slots[find ( it->action, it->state )] = *it;
+  }
+
+  static std::size_t hash ( int action, uint64_t state )
+  {
+    uint64_t h = state ^ ( static_cast<uint64_t> ( action ) * 0x9e3779b97f4a7c15ull );
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+
+    return h;
+  }
+
+  // the counts and the sums are brought up to date on access
+  mutable std::vector<Entry> slots;
+  std::size_t used {0};
+  // the number of the pairs and the sum of their counts by action
+  std::vector<int> pairs;
+  mutable std::vector<long> totals;
+  mutable std::vector<uint32_t> total_epochs;
+  // the factors of the scalings since the last fold
+  std::vector<double> factors;
+  // the keys of the touched pairs, they stay valid when the table grows
+  std::vector<std::pair<int, uint64_t>> touched;
+};
+
+#ifdef Q_LOOKUP_TABLE
+// The Q values of the lookup table in one dense matrix, a row of the values
+// of the actions by their IDs for each state that has been learned. The
+// values that have not been learned are 0, a read never inserts. The rows
+// are widened (doubling) only when a value of a new action is written.
+class QTable
+{
+public:
+
+  // the number of the actions
+  std::size_t size ( void ) const
+  {
+    return actions;
+  }
+
+  void resize ( std::size_t n )
+  {
+    actions = n;
+  }
+
+  // the number of the values in a row
+  std::size_t width ( void ) const
+  {
+    return stride;
+  }
+
+  // the row of the state, nullptr if nothing has been learned in it
+  const double * row ( uint64_t state ) const
+  {
+    std::unordered_map<uint64_t, std::size_t>::const_iterator it = rows.find ( state );
+
+    return it == rows.end() ? nullptr : &values[it->second * stride];
+  }
+
+  double & operator() ( int action, uint64_t state )
+  {
+    if ( action >= ( int ) stride )
+      widen ( action + 1 );
+
+    std::unordered_map<uint64_t, std::size_t>::iterator it = rows.find ( state );
+    if ( it == rows.end() )
+      {
+        it = rows.emplace ( state, rows.size() ).first;
+        values.resize ( values.size() + stride, 0.0 );
+      }
+
+    return values[it->second * stride + action];
+  }
+
+private:
+  void widen ( std::size_t n )
+  {
+    std::size_t w = std::max ( n, 2 * stride );
+    std::vector<double> wide ( rows.size() * w, 0.0 );
+
+    for ( std::size_t r {0}; r < rows.size(); ++r )
+      std::copy ( values.begin() + r * stride, values.begin() + ( r + 1 ) * stride, wide.begin() + r * w );
+
+    values.swap ( wide );
+    stride = w;
+  }
+
+  std::size_t actions {0};
+  std::size_t stride {0};
+  // the rows of the states
+  std::unordered_map<uint64_t, std::size_t> rows;
+  std::vector<double> values;
+};
+#endif
+
+// the visit counts of the states by the triplets of the actions, as the
+// souls hold them
+typedef std::map<SPOTriplet, std::map<uint64_t, int>> Frequencies;
+
+#ifdef FEELINGS
+typedef std::string Feeling;
+#endif
+
+class QL
+{
+public:
+  QL (int nrows)
+  {
+#ifdef FEELINGS
+    std::random_device init;
+    std::default_random_engine gen {init() };
+    //std::uniform_int_distribution<int> dist ( 0, 1 );
+    //std::uniform_int_distribution<int> dist ( 0, 6 );
+    std::uniform_int_distribution<int> dist ( 0, 9 );
+    //std::uniform_int_distribution<int> dist (48, 126 );
+    for ( int i {0}; i<nrows; ++i )
+      {
+        std::stringstream ss;
+        for ( int j {0}; j<10; ++j )
+          {
+            //char c = dist ( gen );
+            //ss << c;
+            ss << dist ( gen );
+          }
+        prcps_f[ss.str()] = new Perceptron ( 3, 10*80, 16,  1 ); //exp.a1 // 302
+      }
+#endif
+#ifdef REPLAY_PRCPS
+    replayer = std::thread ( &QL::replaying, this );
+#endif
+  }
+
+  QL ( SPOTriplet triplet )
+  {}
+
+  ~QL()
+  {
+#ifdef REPLAY_PRCPS
+    {
+      std::unique_lock<std::mutex> lock ( model );
+      replay_stop = true;
+    }
+    replay_wake.notify_all();
+
+    if ( replayer.joinable() )
+      replayer.join();
+#endif
+
+    if ( compactor.joinable() )
+      compactor.join();
+
+    if ( saver > 0 )
+      waitpid ( saver, nullptr, 0 );
+
+#ifdef STORE_PRCPS
+    if ( store.is_open() )
+      {
+        store.close();
+        std::remove ( spill_name.c_str() );
+      }
+#endif
+
+#ifndef Q_LOOKUP_TABLE
+    for ( std::vector<Perceptron*>::iterator it=prcps.begin(); it!=prcps.end(); ++it )
+      delete *it;
+#ifdef TRUNK_PRCPS
+    delete trunk;
+#endif
+#endif
+#ifdef FEELINGS
+    for ( std::map<Feeling, Perceptron*>::iterator it=prcps_f.begin(); it!=prcps_f.end(); ++it )
       delete it->second;
 #endif
-#ifdef FEELINGS
-    for ( std::map<Feeling, Perceptron*>::iterator it=prcps_f.begin(); it!=prcps_f.end(); ++it )
-      delete it->second;
+    
+  }
+
+  double f ( double u, int n )
+  {
+    if ( n < N_e )
+      return max_reward;
+    else
+      return u;
+  }
+
+#ifdef QNN_DEBUG_BREL
+  int get_action_count() const
+  {
+    return frqs.actions();
+  }
+
+  int get_action_relevance() const
+  {
+    return relevance*100.0;
+  }
+#endif
+
+#ifdef STORE_PRCPS
+  // the traffic of the perceptron store (see evict)
+  struct StoreStats
+  {
+    unsigned long hits {0};
+    unsigned long misses {0};
+    unsigned long spills {0};
+    uint64_t spilled_bytes {0};
+    uint64_t reloaded_bytes {0};
+    unsigned long retired {0};
+    unsigned long restored {0};
+  };
+
+  const StoreStats & get_store_stats ( void ) const
+  {
+    return stats;
+  }
+#endif
+
+#ifndef Q_LOOKUP_TABLE
+
+  double max_ap_Q_sp_ap ( Real image[], const ActiveInputs & active )
+  {
+    return max_ap_Q_sp_ap ( image, active, step, qs );
+  }
+
+  // the Q values of the image are memoized by the stamp, q gets them in the
+  // order of the actions (FUSED_PRCPS and POOL_PRCPS)
+  double max_ap_Q_sp_ap ( Real image[], const ActiveInputs & active, unsigned long stamp, std::vector<double> & q )
+  {
+    double q_spap;
+    double min_q_spap = -std::numeric_limits<double>::max();
+
+#ifdef TRUNK_PRCPS
+    // one pass of the trunk serves the heads of all the actions
+    ( *trunk ) ( image, active, stamp );
+#endif
+
+#ifdef FUSED_PRCPS
+    stack ( image, active, q, stamp );
+
+    for ( std::size_t a {0}; a < q.size(); ++a )
+      {
+
+        q_spap = q[a];
+        if ( q_spap > min_q_spap )
+          min_q_spap = q_spap;
+      }
+#elif defined(POOL_PRCPS)
+    sweep ( image, active, stamp, q );
+
+    for ( std::size_t a {0}; a < q.size(); ++a )
+      {
+
+        q_spap = q[a];
+        if ( q_spap > min_q_spap )
+          min_q_spap = q_spap;
+      }
+#else
+    for ( std::vector<Perceptron*>::iterator it=actions.begin(); it!=actions.end(); ++it )
+      {
+
+        q_spap = ( * ( *it ) ) ( image, active, stamp );
+        if ( q_spap > min_q_spap )
+          min_q_spap = q_spap;
+      }
+#endif
+
+    return min_q_spap;
+  }
+#ifdef FEELINGS
+  double max_ap_Q_sp_ap_f ( Real image[] )
+  {
+    double q_spap;
+    double min_q_spap = -std::numeric_limits<double>::max();
+
+    for ( std::map<Feeling, Perceptron*>::iterator it=prcps_f.begin(); it!=prcps_f.end(); ++it )
+      {
+
+        q_spap = ( * ( it->second ) ) ( image );
+        if ( q_spap > min_q_spap )
+          min_q_spap = q_spap;
+      }
+
+    return min_q_spap;
+  }
+#endif
+
+  int argmax_ap_f ( uint64_t prg, Real image[], const ActiveInputs & active )
+  {
+    double min_f = -std::numeric_limits<double>::max();
+    int ap {-1};
+
+#ifdef QNN_DEBUG_BREL
+    double sum {0.0}, rel;
+    double a = std::numeric_limits<double>::max(), b = -std::numeric_limits<double>::max();
+#endif
+
+#ifdef TRUNK_PRCPS
+    ( *trunk ) ( image, active, step );
+#endif
+
+#ifdef FUSED_PRCPS
+    stack ( image, active, qs, step );
+#elif defined(POOL_PRCPS)
+    sweep ( image, active, step, qs );
+#endif
+#ifdef PRUNE_PRCPS
+    ranked.clear();
+#endif
+
+    for ( std::size_t i {0}; i < ids.size(); ++i )
+      {
+
+#ifdef FUSED_PRCPS
+        double  q_spap = qs[order[i]];
+#elif defined(POOL_PRCPS)
+        double  q_spap = qs[i];
+#else
+        double  q_spap = ( * ( actions[i] ) ) ( image, active, step );
+#endif
+        double explor = f ( q_spap, frqs.get ( ids[i], prg ) );
+
+#ifdef PRUNE_PRCPS
+        ranked.push_back ( std::make_pair ( q_spap, ids[i] ) );
+#endif
+
+#ifdef QNN_DEBUG_BREL
+        sum += q_spap;
+
+        if ( q_spap > b )
+          b = q_spap;
+
+        if ( q_spap < a )
+          a = q_spap;
+#endif
+
+        if ( explor >= min_f )
+          {
+            min_f = explor;
+            ap = ids[i];
+#ifdef QNN_DEBUG_BREL
+            rel = q_spap;
+#endif
+          }
+      }
+#ifdef QNN_DEBUG
+    relevance = ( rel - sum/ ( ( double ) ids.size() ) ) / ( b-a );
+#endif
+#ifdef PRUNE_PRCPS
+    rank();
+#endif
+
+    return ap;
+  }
+
+#ifdef FEELINGS
+  Feeling argmax_ap_f_f ( uint64_t prg, Real image[] )
+  {
+    double min_f = -std::numeric_limits<double>::max();
+    Feeling ap;
+
+#ifdef QNN_DEBUG_BREL
+    double sum {0.0}, rel;
+    double a = std::numeric_limits<double>::max(), b = -std::numeric_limits<double>::max();
+#endif
+
+    for ( std::map<Feeling, Perceptron*>::iterator it=prcps_f.begin(); it!=prcps_f.end(); ++it )
+      {
+
+        double  q_spap = ( * ( it->second ) ) ( image );
+        double explor = f ( q_spap, frqs_f[it->first][prg] );
+
+#ifdef QNN_DEBUG_BREL
+        sum += q_spap;
+
+        if ( q_spap > b )
+          b = q_spap;
+
+        if ( q_spap < a )
+          a = q_spap;
+#endif
+
+        if ( explor >= min_f )
+          {
+            min_f = explor;
+            ap = it->first;
+#ifdef QNN_DEBUG_BREL
+            rel = q_spap;
+#endif
+          }
+      }
+#ifdef QNN_DEBUG
+    relevance_f = ( rel - sum/ ( ( double ) prcps_f.size() ) ) / ( b-a );
+#endif
+
+    return ap;
+  }
+#endif
+
+#ifdef INT8_PRCPS
+  // action selection of the inference-only mode, on the int8 perceptrons
+  int argmax_ap_f ( uint64_t prg, const QuantizedInputs & image )
+  {
+    double min_f = -std::numeric_limits<double>::max();
+    int ap {-1};
+
+#ifdef POOL_PRCPS
+    qs.resize ( actions.size() );
+    pool ( actions.size(), [&] ( int a )
+    {
+      qs[a] = ( *actions[a] ) ( image );
+    } );
+#endif
+#ifdef PRUNE_PRCPS
+    ranked.clear();
+#endif
+
+    for ( std::size_t a {0}; a < ids.size(); ++a )
+      {
+
+#ifdef POOL_PRCPS
+        double  q_spap = qs[a];
+#else
+        double  q_spap = ( * ( actions[a] ) ) ( image );
+#endif
+        double explor = f ( q_spap, frqs.get ( ids[a], prg ) );
+
+#ifdef PRUNE_PRCPS
+        ranked.push_back ( std::make_pair ( q_spap, ids[a] ) );
+#endif
+
+        if ( explor >= min_f )
+          {
+            min_f = explor;
+            ap = ids[a];
+          }
+      }
+#ifdef PRUNE_PRCPS
+    rank();
+#endif
+
+    return ap;
+  }
+
+  // Samu answers without learning, the Q values come from the int8 copies
+  void set_inference ( bool inference )
+  {
+    this->inference = inference;
+  }
+
+  bool get_inference ( void ) const
+  {
+    return inference;
+  }
+
+  // refreshes the int8 copies on demand, otherwise it happens at first use after learning
+  void quantize ( void )
+  {
+    for ( std::vector<Perceptron*>::iterator it=actions.begin(); it!=actions.end(); ++it )
+      ( *it )->quantize();
+  }
+#endif
+
+#ifdef FLOAT_PRCPS
+  SPOTriplet operator() ( SPOTriplet triplet, uint64_t prg, double image[] )
+  {
+    // on the stack, the shell and the learner may both call it
+    Real input [sizeof ( prev_image ) / sizeof ( prev_image[0] )];
+    std::copy ( image, image + sizeof ( input ) / sizeof ( input[0] ), input );
+
+    return ( *this ) ( triplet, prg, input );
+  }
+#endif
+
+  SPOTriplet operator() ( SPOTriplet triplet, uint64_t prg, Real image[] )
+  {
+    std::unique_lock<std::mutex> lock ( model );
+
+    // Here 'triplet' will also be used as a simplified state in further developments
+    // s' = triplet
+    // r' = reward
+
+    int id = intern ( triplet );
+
+    double reward =
+      //3.0 * triplet.cmp ( prev_action ) - 1.5;
+      //( triplet == prev_action ) ?1.0:-2.0;
+      ( id == prev_action ) ?max_reward:min_reward;
+
+#ifdef FEELINGS
+    Feeling feeling = prcps_f.begin()->first;
+#endif
+
+#ifdef STORE_PRCPS
+    // the perceptrons needed in this step are brought back from the store
+    fetch ( id );
+    fetch ( prev_action );
+#endif
+
+    if ( !prcps[id] )
+      {
+
+#ifdef TRUNK_PRCPS
+        // the hidden layers are shared, an action has only an output layer
+        if ( !trunk )
+          {
+#ifdef PLACE_VALUE
+            trunk = new Perceptron ( 4, 10*3, 16, 8, 4 );
+#elif FOUR_TIMES
+            trunk = new Perceptron ( 2, 2*10*2*80, 32 );
+#elif CHARACTER_CONSOLE
+            trunk = new Perceptron ( 2, 10*80, 32 );
+#else
+            trunk = new Perceptron ( 2, 256*256, 80 );
+#endif
+          }
+
+        prcps[id] = new Perceptron ( trunk, 1 );
+
+#elif PLACE_VALUE
+//        prcps[triplet] = new Perceptron ( 3, 10*3, 4,  1 ); //exp.a1 // 302
+        prcps[id] = fresh ( {10*3, 16, 8, 4,  1} );
+
+#elif FOUR_TIMES	      
+        prcps[id] = fresh ( {2*10*2*80, 32,  1} );
+	
+#elif CHARACTER_CONSOLE
+        prcps[id] = fresh ( {10*80, 32,  1} ); //exp.a1 // 302
+
+        //prcps[triplet] = new Perceptron ( 3, 10*80, 64,  1 ); //exp.a4
+        //prcps[triplet] = new Perceptron ( 4, 10*80, 256, 32,  1 );
+        //prcps[triplet] = new Perceptron ( 5, 10*80, 256, 128, 32, 1 ); // 355
+        //prcps[triplet] = new Perceptron ( 5, 10*80, 196, 32,  32, 1 ); // 302
+        //prcps[triplet] = new Perceptron ( 5, 10*80, 400, 400,  32, 1 ); // 302
+#else
+        prcps[id] = fresh ( {256*256, 80, 1} );
+        //prcps[triplet] = new Perceptron ( 3, 256*256, 400, 1 );
+#endif
+
+#ifdef FUSED_PRCPS
+        stack.add ( prcps[id] );
+#endif
+        enlist ( id );
+        reorder();
+        dirty.insert ( id );
+#ifdef STORE_PRCPS
+        resident += prcps[id]->footprint();
+#endif
+#ifdef PRUNE_PRCPS
+        ranked_at[id] = step;
+#endif
+      }
+
+#ifdef SPILL_PRCPS
+    evict ( id, prev_action );
+#endif
+#ifdef PRUNE_PRCPS
+    if ( step && step % prune_every == 0 )
+      prune ( id, prev_action );
+#endif
+
+    active ( image, sizeof ( prev_image ) / sizeof ( prev_image[0] ) );
+    // the Q values of this image are memoized for the max and the argmax,
+    // only the perceptron of the previous action learns between them
+    ++step;
+
+    int action = id;
+
+#ifdef INT8_PRCPS
+    if ( inference )
+      {
+        if ( prev_reward >  -std::numeric_limits<double>::max() )
+          {
+            qinput ( image, sizeof ( prev_image ) / sizeof ( prev_image[0] ) );
+            action = argmax_ap_f ( prg, qinput );
+          }
+      }
+    else
+#endif
+    if ( prev_reward >  -std::numeric_limits<double>::max() )
+      {
+        int visits = frqs.add ( prev_action, prev_state );
+        dirty.insert ( prev_action );
+#ifdef FEELINGS
+        ++frqs_f[prev_feeling][prev_state];
+#endif
+
+#ifndef SARSA
+        double max_ap_q_sp_ap = max_ap_Q_sp_ap ( image, active );
+#else
+        double max_ap_q_sp_ap = ( *prcps[action] ) ( image );
+#endif
+
+#ifdef FEELINGS
+        double max_ap_q_sp_ap_f = max_ap_Q_sp_ap_f ( image );
+#endif
+        double old_q_q_s_a_nn_q_s_a;
+
+        for ( int z {0}; z<10; ++z )
+          {
+            double nn_q_s_a = ( *prcps[prev_action] ) ( prev_image, prev_active );
+#ifdef FEELINGS
+            double nn_q_s_a_f = ( *prcps_f[prev_feeling] ) ( prev_image );
+#endif
+
+            double q_q_s_a = nn_q_s_a +
+                             alpha ( visits ) *
+                             ( reward + gamma * max_ap_q_sp_ap - nn_q_s_a );
+
+#ifdef FEELINGS
+            double q_q_s_a_f = nn_q_s_a_f +
+                               alpha ( frqs_f[prev_feeling][prev_state] ) *
+                               ( reward + gamma * max_ap_q_sp_ap_f - nn_q_s_a_f );
+#endif
+            prcps[prev_action]->learning ( prev_image, q_q_s_a, nn_q_s_a, &prev_active );
+
+#ifdef FEELINGS
+            prcps_f[prev_feeling]->learning ( prev_image, q_q_s_a_f, nn_q_s_a_f );
+#endif
+
+#ifdef NN_DEBUG
+	    std::cerr << "### "
+                      << q_q_s_a - nn_q_s_a
+                      << " "
+                      << q_q_s_a
+                      << " "
+                      << nn_q_s_a
+                      << std::endl;
+#ifdef FEELINGS
+            std::cerr << "###Feelings "
+                      << q_q_s_a_f - nn_q_s_a_f
+                      << " "
+                      << q_q_s_a_f
+                      << " "
+                      << nn_q_s_a_f
+                      << std::endl;
+#endif
+#endif
+		      
+            if ( std::fabs ( old_q_q_s_a_nn_q_s_a - ( q_q_s_a - nn_q_s_a ) ) <= 0.0000000001 )
+              break;
+
+            old_q_q_s_a_nn_q_s_a = q_q_s_a - nn_q_s_a;
+
+          }
+
+#ifdef REPLAY_PRCPS
+        experience.push ( prev_image, prev_action, prev_state, reward, image, sizeof ( prev_image ) / sizeof ( prev_image[0] ) );
+        // a replay that falls behind drops its mini-batches, the learner
+        // does not wait for it
+        replays = replay_ratio;
+        replay_wake.notify_one();
+#endif
+
+        action = argmax_ap_f ( prg, image, active );
+#ifdef FEELINGS
+        feeling = argmax_ap_f_f ( prg, image );
+#endif
+      }
+
+    prev_state = prg; 		// s <- s'
+    prev_reward = reward;	// r <- r'
+    prev_action = action;	// a <- a'
+#ifdef FEELINGS
+    prev_feeling = feeling;	// a <- a'
+#endif
+
+#ifdef PLACE_VALUE
+    std::memcpy ( prev_image, image, 10*3*sizeof ( Real ) );
+#elif FOUR_TIMES
+    std::memcpy ( prev_image, image, 2*10*2*80*sizeof ( Real ) );
+#elif CHARACTER_CONSOLE
+    std::memcpy ( prev_image, image, 10*80*sizeof ( Real ) );
+#else
+    std::memcpy ( prev_image, image, 256*256*sizeof ( Real ) );
+#endif
+    std::swap ( prev_active, active );
+
+    return TripletIds::get() [action];
+  }
+
+#else
+
+  double max_ap_Q_sp_ap ( uint64_t prg )
+  {
+    double q_spap;
+    double min_q_spap = -std::numeric_limits<double>::max();
+
+    const double * row = table_.row ( prg );
+    std::size_t width = row ? table_.width() : 0;
+
+    for ( int a : ids )
+      {
+        q_spap = a < ( int ) width ? row[a] : 0.0;
+        if ( q_spap > min_q_spap )
+          min_q_spap = q_spap;
+      }
+
+    return min_q_spap;
+  }
+
+  int argmax_ap_f ( uint64_t prg )
+  {
+    double q_spap;
+    double min_f = -std::numeric_limits<double>::max();
+    int ap {-1};
+
+    const double * row = table_.row ( prg );
+    std::size_t width = row ? table_.width() : 0;
+
+    for ( int a : ids )
+      {
+
+        q_spap = a < ( int ) width ? row[a] : 0.0;
+
+        double explor = f ( q_spap, frqs.get ( a, prg ) );
+
+        if ( explor > min_f )
+          {
+            min_f = explor;
+            ap = a;
+          }
+      }
+
+    return ap;
+  }
+
+  SPOTriplet operator() ( SPOTriplet triplet, uint64_t prg )
+  {
+    std::unique_lock<std::mutex> lock ( model );
+
+    // s' = triplet
+    // r' = reward
+
+    int id = intern ( triplet );
+
+    double reward =
+      3.0*triplet.cmp ( prev_action < 0 ? SPOTriplet() : TripletIds::get() [prev_action] ) - 1.5;
+
+    int action = id;
+
+    if ( prev_reward >  -std::numeric_limits<double>::max() )
+      {
+
+        int visits = frqs.add ( prev_action, prev_state );
+        dirty.insert ( prev_action );
+
+        double max_ap_q_sp_ap = max_ap_Q_sp_ap ( prg );
+
+        double & q = table_ ( prev_action, prev_state );
+        q = q + alpha ( visits ) * ( reward + gamma * max_ap_q_sp_ap - q );
+
+        action = argmax_ap_f ( prg );
+
+      }
+
+    prev_state = prg; 		// s <- s'
+    prev_reward = reward;   	// r <- r'
+    prev_action = action;	// a <- a'
+
+    return TripletIds::get() [action];
+  }
+
+#endif
+
+  double reward ( void )
+  {
+    return prev_reward;
+  }
+#ifdef FEELINGS
+  Feeling feeling ( void )
+  {
+    return prev_feeling;
+  }
+#endif
+  double alpha ( int n )
+  {
+    return 1.0/ ( ( ( double ) n ) + 1.0 );
+  }
+
+  // the scalings are O(1) (see VisitTable), the next delta has their factors
+  // instead of all the counts
+  void clearn ( void )
+  {
+    std::unique_lock<std::mutex> lock ( model );
+
+    frqs.scale ( 0.0 );
+    scalings.push_back ( 0.0 );
+
+  }
+
+  double sigmoid ( int n )
+  {
+    return 1.0/ ( 1.0 + exp ( -n ) );
+  }
+
+  void scalen ( double s )
+  {
+    std::unique_lock<std::mutex> lock ( model );
+
+    //itt->second -= ( itt->second / 5 );
+    frqs.scale ( s );
+    scalings.push_back ( s );
+
+  }
+
+#ifndef Q_LOOKUP_TABLE
+  // the lookup table has no soul
+  void save_prcps ( std::fstream & samuFile )
+  {
+    // the soul is tagged by the precision of the weights
+    samuFile << ( sizeof ( Real ) == sizeof ( float ) ? "float" : "double" );
+
+#ifdef TRUNK_PRCPS
+    if ( trunk )
+      {
+        samuFile << " trunk";
+        trunk->save ( samuFile );
+      }
+#endif
+
+    samuFile << " "
+             << ids.size();
+
+    int prev_p {0};
+    for ( std::vector<int>::iterator it=ids.begin(); it!=ids.end(); ++it )
+      {
+        int p = ( std::distance ( ids.begin(), it ) * 100 ) / ids.size();
+        if ( p > prev_p+9 )
+          {
+            std::cerr << "Saving Samu: "
+                      << p
+                      << "% (perceptrons)"
+                      << std::endl;
+            prev_p = p;
+          }
+        samuFile << " "
+                 << TripletIds::get() [*it];
+        prcps[*it]->save ( samuFile );
+      }
+  }
+
+  // the states are written by their fingerprints, the tag tells the table
+  // from the text states of the earlier souls
+  void save_frqs ( std::fstream & samuFile )
+  {
+    Frequencies counted = frequencies ( false );
+
+    samuFile << std::endl
+             << "states "
+             << counted.size();
+
+    int prev_p {0};
+    for ( Frequencies::iterator it=counted.begin(); it!=counted.end(); ++it )
+      {
+
+        int p = ( std::distance ( counted.begin(), it ) * 100 ) / counted.size();
+        if ( p > prev_p+9 )
+          {
+            std::cerr << "Saving Samu: "
+                      << p
+                      << "% (frequency table)"
+                      << std::endl;
+            prev_p = p;
+          }
+
+        samuFile << " "
+                 << it->first
+                 << " "
+                 << it->second.size();
+        for ( std::map<uint64_t, int>::iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
+          {
+            samuFile << " "
+                     << itt->first
+                     << " "
+                     << itt->second;
+          }
+      }
+
+  }
+
+  // the text soul of the earlier versions
+  void save_text ( std::string & fname )
+  {
+    std::fstream samuFile ( fname,  std::ios_base::out );
+
+    save_prcps ( samuFile );
+    save_frqs ( samuFile );
+
+    samuFile.close();
+  }
+
+  // The binary soul (see soul.hpp) with all the changes, the learning
+  // waits until it is written (see snapshot).
+  void save ( std::string & fname )
+  {
+    if ( compactor.joinable() )
+      compactor.join();
+
+    if ( saver > 0 )
+      waitpid ( saver, nullptr, 0 );
+    saver = 0;
+
+    std::unique_lock<std::mutex> lock ( model );
+
+    rebase ( fname );
+  }
+
+  // The whole soul under the model lock, the journal is dropped: its deltas
+  // are included or belong to an earlier soul.
+  void rebase ( std::string & fname )
+  {
+    if ( !write ( fname ) )
+      return;
+
+    dirty.clear();
+    frqs.untouch();
+    scalings.clear();
+    std::remove ( ( fname + ".journal" ).c_str() );
+    std::remove ( ( fname + ".journal.old" ).c_str() );
+  }
+
+  // The soul is saved by a forked copy of the process, which shares the
+  // pages of the model copy-on-write, so the learning goes on while the
+  // snapshot is written. The journal is kept: its deltas are included in
+  // the snapshot or newer than it. A snapshot in progress is not doubled.
+  void snapshot ( std::string & fname )
+  {
+    if ( snapshotting() )
+      return;
+
+    // the copy is not to be forked in the middle of a step
+    std::unique_lock<std::mutex> lock ( model );
+
+    // the first soul of a run, a journal left there belongs to an earlier
+    // one (a run that crashed before its first soul)
+    struct stat st;
+    if ( stat ( fname.c_str(), &st ) )
+      {
+        std::remove ( ( fname + ".journal" ).c_str() );
+        std::remove ( ( fname + ".journal.old" ).c_str() );
+      }
+
+    // the snapshot has the scaled counts, so the scalings pending are
+    // journaled first lest the next delta scale them again
+    if ( !scalings.empty() && !append ( fname ) )
+      return;
+
+    // the buffered output is not to be written twice
+    std::cout.flush();
+    std::fflush ( nullptr );
+
+    saver = fork();
+
+    if ( !saver )
+      _exit ( write ( fname ) ? 0 : 1 );
+
+    if ( saver == -1 )
+      std::cerr << "Saving Samu: the snapshot cannot be forked"
+                << std::endl;
+  }
+
+  bool snapshotting ( void )
+  {
+    if ( saver > 0 && !waitpid ( saver, nullptr, WNOHANG ) )
+      return true;
+
+    saver = 0;
+    return false;
+  }
+
+  // Appends a delta of the changes since the previous checkpoint to the
+  // journal of the soul. When the journal has grown larger than the soul,
+  // it is merged into the soul in the background (see compact). The deltas
+  // need a whole soul to be applied to, so the first checkpoint of a run
+  // without a soul saves one instead.
+  void checkpoint ( std::string & fname )
+  {
+    std::unique_lock<std::mutex> lock ( model );
+
+    struct stat st, jst;
+    if ( stat ( fname.c_str(), &st ) )
+      {
+        // a snapshot in progress writes it
+        if ( !snapshotting() && ( !dirty.empty() || !frqs.untouched() || !scalings.empty() ) )
+          rebase ( fname );
+        return;
+      }
+
+    if ( !append ( fname ) )
+      return;
+
+    if ( compacting )
+      return;
+
+    if ( compactor.joinable() )
+      compactor.join();
+
+    // a journal left by a failed compaction is merged first
+    std::string journal {fname + ".journal"};
+    std::string old {journal + ".old"};
+    if ( stat ( old.c_str(), &jst ) )
+      {
+        if ( stat ( journal.c_str(), &jst ) || jst.st_size <= st.st_size )
+          return;
+
+        if ( std::rename ( journal.c_str(), old.c_str() ) )
+          return;
+      }
+
+    compacting = true;
+    compactor = std::thread ( [this, fname] ()
+    {
+      compact ( fname );
+      compacting = false;
+    } );
+  }
+
+  // The delta is appended under the model lock, false if there is no change
+  // or it cannot be written.
+  bool append ( std::string & fname )
+  {
+    if ( dirty.empty() && frqs.untouched() && scalings.empty() )
+      return false;
+
+    std::string journal {fname + ".journal"};
+    std::fstream file ( journal, std::ios_base::in | std::ios_base::out | std::ios_base::binary );
+    if ( !file )
+      file.open ( journal, std::ios_base::out | std::ios_base::binary );
+
+    file.seekp ( 0, std::ios_base::end );
+    std::streamoff end = file.tellp();
+    try
+      {
+        write_soul ( file, true );
+      }
+    catch ( const char * err )
+      {
+        std::cerr << err << std::endl;
+        file.setstate ( std::ios_base::failbit );
+      }
+    file.close();
+
+    if ( !file )
+      {
+        std::cerr << "Saving Samu: "
+                  << journal
+                  << " cannot be written"
+                  << std::endl;
+
+        // the next delta must follow the last whole one
+        if ( end >= 0 && truncate ( journal.c_str(), end ) )
+          std::cerr << journal
+                    << " cannot be truncated"
+                    << std::endl;
+        return false;
+      }
+
+    dirty.clear();
+    frqs.untouch();
+    scalings.clear();
+
+    return true;
+  }
+
+  void load_prcps ( std::fstream & file )
+  {
+    int prcpsSize {0};
+
+    // untagged souls were saved in double precision, the weights are
+    // converted to the precision of this build while they are read
+    std::string tag;
+    file >> tag;
+    if ( tag == "float" || tag == "double" )
+      file >> tag;
+
+    if ( tag == "trunk" )
+      {
+#ifdef TRUNK_PRCPS
+        trunk = new Perceptron ( file );
+        file >> tag;
+#else
+        throw "The perceptrons of this soul share a trunk, it needs TRUNK_PRCPS.";
+#endif
+      }
+
+    prcpsSize = std::stoi ( tag );
+
+#ifdef TRUNK_PRCPS
+    if ( prcpsSize && !trunk )
+      throw "The perceptrons of this soul have no shared trunk, it needs a build without TRUNK_PRCPS.";
 #endif
-    
+
+    int prev_p {0};
+    SPOTriplet t;
+    for ( int s {0}; s< prcpsSize; ++s )
+      {
+        int p = ( s * 100 ) / prcpsSize;
+        if ( p > prev_p+9 )
+          {
+            std::cerr << "Loading Samu: "
+                      << p
+                      << "% (perceptrons)"
+                      << std::endl;
+            prev_p = p;
+          }
+
+
+        file >> t;
+
+#ifdef TRUNK_PRCPS
+        adopt ( intern ( t ), std::unique_ptr<Perceptron> ( new Perceptron ( file, trunk ) ) );
+#else
+        adopt ( intern ( t ), std::unique_ptr<Perceptron> ( new Perceptron ( file ) ) );
+#endif
+      }
+
+    reorder();
+
+  }
+
+  // the states of the earlier text souls are fingerprinted while they are read
+  void load_frqs ( std::fstream & file )
+  {
+    int frqsSize {0};
+
+    std::string tag;
+    file >> tag;
+    bool states = tag == "states";
+    if ( states )
+      file >> tag;
+
+    frqsSize = std::stoi ( tag );
+
+    int prev_pc {0};
+    int mapSize {0};
+    SPOTriplet t;
+    std::string p;
+    int n;
+    for ( int s {0}; s< frqsSize; ++s )
+      {
+
+        int pc = ( s * 100 ) / frqsSize;
+        if ( pc > prev_pc+9 )
+          {
+            std::cerr << "Loading Samu: "
+                      << pc
+                      << "% (frequency table)"
+                      << std::endl;
+            prev_pc = pc;
+          }
+
+        file >> t;
+        file >> mapSize;
+        for ( int ss {0}; ss< mapSize; ++ss )
+          {
+            file >> p;
+            file >> n;
+
+            frqs.set ( intern ( t ), states ? std::stoull ( p ) : fingerprint ( p ), n );
+          }
+      }
+    frqs.untouch();
+  }
+
+
+  // binary or text soul, under MMAP_SOUL the perceptrons of a binary soul
+  // of this precision are mapped from the file instead of being read
+  void load ( std::string & fname )
+  {
+    std::fstream file ( fname, std::ios_base::in | std::ios_base::binary );
+
+    if ( !file )
+      throw "The soul cannot be opened.";
+
+#ifdef MMAP_SOUL
+    load ( file, std::unique_ptr<SoulMapping> ( new SoulMapping ( fname ) ) );
+#else
+    load ( file );
+#endif
+
+    replay ( fname + ".journal.old" );
+
+    // the next deltas are appended after the last whole one
+    std::string journal {fname + ".journal"};
+    std::streamoff end = replay ( journal );
+    struct stat st;
+    if ( !stat ( journal.c_str(), &st ) && st.st_size > end && truncate ( journal.c_str(), end ) )
+      std::cerr << journal
+                << " cannot be truncated"
+                << std::endl;
+  }
+
+  void load ( std::fstream & file, std::unique_ptr<SoulMapping> mapping = nullptr )
+  {
+    std::streamoff start = file.tellg();
+
+    char magic[sizeof ( soul_magic )] {};
+    file.read ( magic, sizeof ( magic ) );
+    file.clear();
+    file.seekg ( start );
+
+    if ( !std::memcmp ( magic, soul_magic, sizeof ( magic ) ) )
+      {
+        load_soul ( file, std::move ( mapping ) );
+      }
+    else
+      {
+        // the counts of a text soul are parsed by std::stoi and std::stoull
+        try
+          {
+            load_prcps ( file );
+            load_frqs ( file );
+          }
+        catch ( const std::logic_error & )
+          {
+            throw "The soul is corrupted.";
+          }
+      }
+  }
+
+  // A text soul of the earlier versions is saved at once as the binary soul
+  // fname. The deltas of its journal hold only the changes, so they need a
+  // whole soul to be merged into. A journal left there belongs to an earlier
+  // soul, save drops it.
+  void convert ( std::fstream & file, std::string & fname )
+  {
+    load ( file );
+    save ( fname );
+  }
+
+  void load_soul ( std::fstream & file, std::unique_ptr<SoulMapping> mapping = nullptr, bool delta = false )
+  {
+    SoulHeader header;
+    std::streamoff start = file.tellg();
+
+    if ( !file.read ( reinterpret_cast<char *> ( &header ), sizeof ( header ) ) )
+      throw "The soul is truncated.";
+
+    if ( crc32c ( 0, &header, offsetof ( SoulHeader, header_crc ) ) != header.header_crc )
+      throw "The header of the soul is corrupted.";
+
+    if ( header.version < 1 || header.version > soul_version )
+      throw "This version of the soul is not supported.";
+
+    if ( header.real_size != sizeof ( float ) && header.real_size != sizeof ( double ) )
+      throw "The precision of the soul is not supported.";
+
+    SoulReader in ( file, header.real_size );
+    in.set_base ( start );
+
+#ifdef TRUNK_PRCPS
+    if ( header.n_prcps && !header.trunk )
+      throw "The perceptrons of this soul have no shared trunk, it needs a build without TRUNK_PRCPS.";
+
+    if ( header.trunk )
+      {
+        in.seek ( header.trunk );
+        in.begin();
+        std::unique_ptr<Perceptron> p ( new Perceptron ( in ) );
+        in.check ( header.trunk_crc, "The trunk of the soul is corrupted." );
+
+        // the heads already loaded keep their trunk
+        if ( trunk )
+          trunk->assign ( *p );
+        else
+          trunk = p.release();
+      }
+#else
+    if ( header.trunk )
+      throw "The perceptrons of this soul share a trunk, it needs TRUNK_PRCPS.";
+#endif
+
+    std::vector<int> triplets;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> crcs;
+
+    std::istringstream tableSection ( in.section ( header.table, header.table_size, header.table_crc,
+                                      "The triplet table of the soul is corrupted." ) );
+    SoulReader table ( tableSection, header.real_size );
+    for ( uint32_t a {0}; a < header.n_prcps; ++a )
+      {
+        triplets.push_back ( intern ( get_triplet ( table ) ) );
+        offsets.push_back ( table.get<uint64_t>() );
+        crcs.push_back ( table.get<uint32_t>() );
+      }
+
+#ifdef MMAP_SOUL
+    // the blocks are used in place, so their checksums are not verified, as
+    // that would read the whole soul
+    char * map {nullptr};
+    if ( mapping && mapping->data && start == 0 && header.real_size == sizeof ( Real ) )
+      {
+        map = mapping->data;
+        mappings.push_back ( std::move ( mapping ) );
+      }
+    const char * mapEnd = map + ( map ? mappings.back()->size : 0 );
+#endif
+
+    int prev_p {0};
+    for ( uint32_t a {0}; a < header.n_prcps; ++a )
+      {
+#ifdef MMAP_SOUL
+        if ( map )
+          {
+            if ( offsets[a] % 64 || offsets[a] > mappings.back()->size )
+              throw "A perceptron of the soul is corrupted.";
+
+#ifdef TRUNK_PRCPS
+            adopt ( triplets[a], std::unique_ptr<Perceptron> ( new Perceptron ( map + offsets[a], mapEnd, trunk ) ) );
+#else
+            adopt ( triplets[a], std::unique_ptr<Perceptron> ( new Perceptron ( map + offsets[a], mapEnd ) ) );
+#endif
+#ifdef SPILL_PRCPS
+            evict ( -1, -1 );
+#endif
+            continue;
+          }
+#endif
+
+        int p = ( a * 100 ) / header.n_prcps;
+        if ( !delta && p > prev_p+9 )
+          {
+            std::cerr << "Loading Samu: "
+                      << p
+                      << "% (perceptrons)"
+                      << std::endl;
+            prev_p = p;
+          }
+
+        in.seek ( offsets[a] );
+        in.begin();
+#ifdef TRUNK_PRCPS
+        std::unique_ptr<Perceptron> prcp ( new Perceptron ( in, trunk ) );
+#else
+        std::unique_ptr<Perceptron> prcp ( new Perceptron ( in ) );
+#endif
+        in.check ( crcs[a], "A perceptron of the soul is corrupted." );
+
+        adopt ( triplets[a], std::move ( prcp ) );
+#ifdef SPILL_PRCPS
+        evict ( -1, -1 );
+#endif
+      }
+
+    reorder();
+
+    Frequencies f;
+    std::vector<double> factors;
+
+    std::istringstream frqsSection ( in.section ( header.frqs, header.frqs_size, header.frqs_crc,
+                                     "The frequency table of the soul is corrupted." ) );
+    SoulReader table_f ( frqsSection, header.real_size );
+    get_frqs ( table_f, header.version, f, factors );
+
+    for ( std::size_t i {0}; i < factors.size(); ++i )
+      frqs.scale ( factors[i] );
+
+    for ( Frequencies::iterator it=f.begin(); it!=f.end(); ++it )
+      {
+        int id = intern ( it->first );
+
+        for ( std::map<uint64_t, int>::iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
+          frqs.set ( id, itt->first, itt->second );
+      }
+    // the loaded counts are in the soul already
+    frqs.untouch();
+
+    last_delta = std::max ( last_delta, header.journal );
   }
+#endif
 
-  double f ( double u, int n )
+  int get_N_e ( void ) const
   {
-    if ( n < N_e )
-      return max_reward;
-    else
-      return u;
+    return N_e;
   }
 
-#ifdef QNN_DEBUG_BREL
-  int get_action_count() const
+  void set_N_e ( int N_e )
   {
-    return frqs.size();
+    this->N_e = N_e;
   }
 
-  int get_action_relevance() const
+  double get_max_reward ( void ) const
   {
-    return relevance*100.0;
+    return max_reward;
   }
-#endif
 
-#ifndef Q_LOOKUP_TABLE
-
-  double max_ap_Q_sp_ap ( double image[] )
+  double get_min_reward ( void ) const
   {
-    double q_spap;
-    double min_q_spap = -std::numeric_limits<double>::max();
+    return min_reward;
+  }
 
-    for ( std::map<SPOTriplet, Perceptron*>::iterator it=prcps.begin(); it!=prcps.end(); ++it )
-      {
 
-        q_spap = ( * ( it->second ) ) ( image );
-        if ( q_spap > min_q_spap )
-          min_q_spap = q_spap;
-      }
+private:
 
-    return min_q_spap;
-  }
-#ifdef FEELINGS
-  double max_ap_Q_sp_ap_f ( double image[] )
+#ifndef Q_LOOKUP_TABLE
+  // writes the soul into a temporary file that replaces the previous soul
+  // only if the whole soul has been saved
+  bool write ( std::string & fname )
   {
-    double q_spap;
-    double min_q_spap = -std::numeric_limits<double>::max();
+    std::string tmp {fname + ".tmp"};
+    std::fstream samuFile ( tmp,  std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
 
-    for ( std::map<Feeling, Perceptron*>::iterator it=prcps_f.begin(); it!=prcps_f.end(); ++it )
+    try
       {
+        write_soul ( samuFile, false );
+      }
+    catch ( const char * err )
+      {
+        std::cerr << err << std::endl;
+        samuFile.setstate ( std::ios_base::failbit );
+      }
+    samuFile.close();
 
-        q_spap = ( * ( it->second ) ) ( image );
-        if ( q_spap > min_q_spap )
-          min_q_spap = q_spap;
+    if ( !samuFile || std::rename ( tmp.c_str(), fname.c_str() ) )
+      {
+        std::cerr << "Saving Samu: "
+                  << fname
+                  << " cannot be written"
+                  << std::endl;
+        return false;
       }
 
-    return min_q_spap;
+    return true;
   }
-#endif
 
-  SPOTriplet argmax_ap_f ( std::string prg, double image[] )
+  // Writes a soul from the current position of the file. A delta holds only
+  // the perceptrons and the frequencies changed since the last checkpoint.
+  void write_soul ( std::fstream & samuFile, bool delta )
   {
-    double min_f = -std::numeric_limits<double>::max();
-    SPOTriplet ap;
+    std::streamoff start = samuFile.tellp();
 
-#ifdef QNN_DEBUG_BREL
-    double sum {0.0}, rel;
-    double a = std::numeric_limits<double>::max(), b = -std::numeric_limits<double>::max();
+    SoulWriter out ( samuFile );
+    SoulHeader header {};
+
+    out.write ( &header, sizeof ( header ) );
+    out.align();
+
+#ifdef TRUNK_PRCPS
+    if ( trunk )
+      {
+        out.begin();
+        header.trunk = out.tell();
+        trunk->save ( out );
+        header.trunk_size = out.tell() - header.trunk;
+        header.trunk_crc = out.checksum();
+        out.align();
+      }
 #endif
 
-    for ( std::map<SPOTriplet, Perceptron*>::iterator it=prcps.begin(); it!=prcps.end(); ++it )
+    std::vector<int> saved;
+
+    if ( delta )
       {
+        for ( std::set<int>::iterator it=dirty.begin(); it!=dirty.end(); ++it )
+          if ( prcps[*it] )
+            saved.push_back ( *it );
+      }
+    else
+      saved = ids;
 
-        double  q_spap = ( * ( it->second ) ) ( image );
-        double explor = f ( q_spap, frqs[it->first][prg] );
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> crcs;
 
-#ifdef QNN_DEBUG_BREL
-        sum += q_spap;
+    int prev_p {0};
+    for ( std::size_t a {0}; a < saved.size(); ++a )
+      {
+        int p = ( a * 100 ) / saved.size();
+        if ( !delta && p > prev_p+9 )
+          {
+            std::cerr << "Saving Samu: "
+                      << p
+                      << "% (perceptrons)"
+                      << std::endl;
+            prev_p = p;
+          }
 
-        if ( q_spap > b )
-          b = q_spap;
+        out.begin();
+        offsets.push_back ( out.tell() );
+        prcps[saved[a]]->save ( out );
+        crcs.push_back ( out.checksum() );
+        out.align();
+      }
 
-        if ( q_spap < a )
-          a = q_spap;
-#endif
+#ifdef STORE_PRCPS
+    // the spilled perceptrons are copied from the store
+    std::vector<std::map<int, Spill>::iterator> copied;
 
-        if ( explor >= min_f )
+    if ( delta )
+      {
+        for ( std::set<int>::iterator it=dirty.begin(); it!=dirty.end(); ++it )
           {
-            min_f = explor;
-            ap = it->first;
-#ifdef QNN_DEBUG_BREL
-            rel = q_spap;
-#endif
+            std::map<int, Spill>::iterator p = spilled.find ( *it );
+            if ( p != spilled.end() )
+              copied.push_back ( p );
           }
       }
-#ifdef QNN_DEBUG
-    relevance = ( rel - sum/ ( ( double ) prcps.size() ) ) / ( b-a );
+    else
+      {
+        for ( std::map<int, Spill>::iterator it=spilled.begin(); it!=spilled.end(); ++it )
+          copied.push_back ( it );
+      }
+
+    std::fstream spill ( spill_name, std::ios_base::in | std::ios_base::binary );
+    for ( std::size_t a {0}; a < copied.size(); ++a )
+      {
+        out.begin();
+        offsets.push_back ( out.tell() );
+        copy_block ( spill, 0, copied[a]->second.offset, copied[a]->second.crc, sizeof ( Real ), out );
+        crcs.push_back ( out.checksum() );
+        out.align();
+      }
 #endif
 
-    return ap;
+    out.begin();
+    header.table = out.tell();
+    for ( std::size_t a {0}; a < saved.size(); ++a )
+      {
+        put ( out, TripletIds::get() [saved[a]] );
+        out.put<uint64_t> ( offsets[a] );
+        out.put<uint32_t> ( crcs[a] );
+      }
+#ifdef STORE_PRCPS
+    for ( std::size_t a {0}; a < copied.size(); ++a )
+      {
+        put ( out, TripletIds::get() [copied[a]->first] );
+        out.put<uint64_t> ( offsets[saved.size() + a] );
+        out.put<uint32_t> ( crcs[saved.size() + a] );
+      }
+#endif
+    header.table_size = out.tell() - header.table;
+    header.table_crc = out.checksum();
+    out.align();
+
+    out.begin();
+    header.frqs = out.tell();
+    put_frqs ( out, frequencies ( delta ), delta ? scalings : std::vector<double>() );
+    header.frqs_size = out.tell() - header.frqs;
+    header.frqs_crc = out.checksum();
+
+    std::memcpy ( header.magic, soul_magic, sizeof ( header.magic ) );
+    header.version = soul_version;
+    header.real_size = sizeof ( Real );
+    header.n_prcps = offsets.size();
+    header.journal = delta ? ++last_delta : last_delta;
+    header.header_crc = crc32c ( 0, &header, offsetof ( SoulHeader, header_crc ) );
+
+    samuFile.seekp ( start );
+    samuFile.write ( reinterpret_cast<const char *> ( &header ), sizeof ( header ) );
   }
 
-#ifdef FEELINGS
-  Feeling argmax_ap_f_f ( std::string prg, double image[] )
+  // the header of a soul or a delta at the current position of the file,
+  // false at the end of a journal or at a torn delta
+  static bool read_header ( std::fstream & file, SoulHeader & header )
   {
-    double min_f = -std::numeric_limits<double>::max();
-    Feeling ap;
+    return file.read ( reinterpret_cast<char *> ( &header ), sizeof ( header ) )
+           && !std::memcmp ( header.magic, soul_magic, sizeof ( header.magic ) )
+           && crc32c ( 0, &header, offsetof ( SoulHeader, header_crc ) ) == header.header_crc;
+  }
 
-#ifdef QNN_DEBUG_BREL
-    double sum {0.0}, rel;
-    double a = std::numeric_limits<double>::max(), b = -std::numeric_limits<double>::max();
-#endif
+  // Applies the deltas of a journal that are newer than the loaded soul, a
+  // torn delta at the end of the journal (a crash while it was written) is
+  // dropped. It returns the end of the last whole delta.
+  std::streamoff replay ( const std::string & fname )
+  {
+    std::fstream file ( fname, std::ios_base::in | std::ios_base::binary );
+    SoulHeader header;
+    std::streamoff start {0};
 
-    for ( std::map<Feeling, Perceptron*>::iterator it=prcps_f.begin(); it!=prcps_f.end(); ++it )
+    for ( ; file.seekg ( start ) && read_header ( file, header ); start += header.frqs + header.frqs_size )
       {
+        if ( header.journal <= last_delta )
+          continue;
 
-        double  q_spap = ( * ( it->second ) ) ( image );
-        double explor = f ( q_spap, frqs_f[it->first][prg] );
-
-#ifdef QNN_DEBUG_BREL
-        sum += q_spap;
-
-        if ( q_spap > b )
-          b = q_spap;
-
-        if ( q_spap < a )
-          a = q_spap;
-#endif
+        file.seekg ( start );
 
-        if ( explor >= min_f )
+        try
           {
-            min_f = explor;
-            ap = it->first;
-#ifdef QNN_DEBUG_BREL
-            rel = q_spap;
-#endif
+            load_soul ( file, nullptr, true );
+          }
+        catch ( const char * err )
+          {
+            std::cerr << fname
+                      << ": "
+                      << err
+                      << std::endl;
+            break;
           }
       }
-#ifdef QNN_DEBUG
-    relevance_f = ( rel - sum/ ( ( double ) prcps_f.size() ) ) / ( b-a );
-#endif
 
-    return ap;
+    return start;
   }
-#endif
 
-  SPOTriplet operator() ( SPOTriplet triplet, std::string prg, double image[] )
+  // Merges the deltas of the rotated journal into the soul. Only the files
+  // are touched, so it runs beside the learning; the blocks of the
+  // perceptrons are copied as they are, their checksums are verified.
+  static void compact ( const std::string & fname )
   {
+    std::string old {fname + ".journal.old"};
+    std::string tmp {fname + ".compact"};
 
-    // Here 'triplet' will also be used as a simplified state in further developments
-    // s' = triplet
-    // r' = reward
-
-    double reward =
-      //3.0 * triplet.cmp ( prev_action ) - 1.5;
-      //( triplet == prev_action ) ?1.0:-2.0;
-      ( triplet == prev_action ) ?max_reward:min_reward;
-
-#ifdef FEELINGS
-    Feeling feeling = prcps_f.begin()->first;
-#endif
-
-    if ( prcps.find ( triplet ) == prcps.end() )
+    try
       {
+        struct Block
+        {
+          std::size_t file;
+          std::streamoff base;
+          uint64_t offset;
+          uint32_t crc;
+        };
+
+        std::fstream files[2];
+        files[0].open ( fname, std::ios_base::in | std::ios_base::binary );
+        files[1].open ( old, std::ios_base::in | std::ios_base::binary );
+
+        std::map<SPOTriplet, Block> blocks;
+        Frequencies f;
+        Block trunkBlock {0, 0, 0, 0};
+        uint32_t real_size {0};
+        uint32_t journal {0};
+
+        for ( std::size_t k {0}; k < 2; ++k )
+          {
+            SoulHeader header;
 
-#ifdef PLACE_VALUE
-//        prcps[triplet] = new Perceptron ( 3, 10*3, 4,  1 ); //exp.a1 // 302
-        prcps[triplet] = new Perceptron ( 5, 10*3, 16, 8, 4,  1 );
-
-#elif FOUR_TIMES	      
-        prcps[triplet] = new Perceptron ( 3, 2*10*2*80, 32,  1 ); 
-	
-#elif CHARACTER_CONSOLE
-        prcps[triplet] = new Perceptron ( 3, 10*80, 32,  1 ); //exp.a1 // 302
-
-        //prcps[triplet] = new Perceptron ( 3, 10*80, 64,  1 ); //exp.a4
-        //prcps[triplet] = new Perceptron ( 4, 10*80, 256, 32,  1 );
-        //prcps[triplet] = new Perceptron ( 5, 10*80, 256, 128, 32, 1 ); // 355
-        //prcps[triplet] = new Perceptron ( 5, 10*80, 196, 32,  32, 1 ); // 302
-        //prcps[triplet] = new Perceptron ( 5, 10*80, 400, 400,  32, 1 ); // 302
-#else
-        prcps[triplet] = new Perceptron ( 3, 256*256, 80, 1 );
-        //prcps[triplet] = new Perceptron ( 3, 256*256, 400, 1 );
-#endif
-      }
+            for ( std::streamoff start {0}; files[k].seekg ( start ) && read_header ( files[k], header );
+                  start += header.frqs + header.frqs_size )
+              {
+                if ( k && header.journal <= journal )
+                  continue;
+
+                if ( header.version < 1 || header.version > soul_version )
+                  throw "This version of the soul is not supported.";
+
+                if ( real_size && real_size != header.real_size )
+                  throw "The precisions of the soul and its journal differ.";
+
+                real_size = header.real_size;
+                journal = header.journal;
+
+                SoulReader in ( files[k], real_size );
+                in.set_base ( start );
+
+                if ( header.trunk )
+                  trunkBlock = Block {k, start, header.trunk, header.trunk_crc};
+
+                std::istringstream tableSection ( in.section ( header.table, header.table_size, header.table_crc,
+                                                  "The triplet table of the soul is corrupted." ) );
+                SoulReader table ( tableSection, real_size );
+                for ( uint32_t a {0}; a < header.n_prcps; ++a )
+                  {
+                    SPOTriplet t = get_triplet ( table );
+                    uint64_t offset = table.get<uint64_t>();
+                    blocks[t] = Block {k, start, offset, table.get<uint32_t>() };
+                  }
+
+                std::istringstream frqsSection ( in.section ( header.frqs, header.frqs_size, header.frqs_crc,
+                                                 "The frequency table of the soul is corrupted." ) );
+                SoulReader table_f ( frqsSection, real_size );
+                Frequencies d;
+                std::vector<double> factors;
+                get_frqs ( table_f, header.version, d, factors );
+
+                scale ( f, factors );
+                for ( Frequencies::iterator it=d.begin(); it!=d.end(); ++it )
+                  for ( std::map<uint64_t, int>::iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
+                    f[it->first][itt->first] = itt->second;
+              }
 
-    SPOTriplet action = triplet;
+            files[k].clear();
+          }
 
-    if ( prev_reward >  -std::numeric_limits<double>::max() )
-      {
-        ++frqs[prev_action][prev_state];
-#ifdef FEELINGS
-        ++frqs_f[prev_feeling][prev_state];
-#endif
+        if ( !real_size )
+          return;
 
-#ifndef SARSA
-        double max_ap_q_sp_ap = max_ap_Q_sp_ap ( image );
-#else
-        double max_ap_q_sp_ap = ( *prcps[action] ) ( image );
-#endif
+        std::fstream samuFile ( tmp,  std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+        SoulWriter out ( samuFile );
+        SoulHeader header {};
 
-#ifdef FEELINGS
-        double max_ap_q_sp_ap_f = max_ap_Q_sp_ap_f ( image );
-#endif
-        double old_q_q_s_a_nn_q_s_a;
+        out.write ( &header, sizeof ( header ) );
+        out.align();
 
-        for ( int z {0}; z<10; ++z )
+        if ( trunkBlock.offset )
           {
-            double nn_q_s_a = ( *prcps[prev_action] ) ( prev_image );
-#ifdef FEELINGS
-            double nn_q_s_a_f = ( *prcps_f[prev_feeling] ) ( prev_image );
-#endif
-
-            double q_q_s_a = nn_q_s_a +
-                             alpha ( frqs[prev_action][prev_state] ) *
-                             ( reward + gamma * max_ap_q_sp_ap - nn_q_s_a );
-
-#ifdef FEELINGS
-            double q_q_s_a_f = nn_q_s_a_f +
-                               alpha ( frqs_f[prev_feeling][prev_state] ) *
-                               ( reward + gamma * max_ap_q_sp_ap_f - nn_q_s_a_f );
-#endif
-            prcps[prev_action]->learning ( prev_image, q_q_s_a, nn_q_s_a );
-
-#ifdef FEELINGS
-            prcps_f[prev_feeling]->learning ( prev_image, q_q_s_a_f, nn_q_s_a_f );
-#endif
-
-#ifdef NN_DEBUG
-	    std::cerr << "### "
-                      << q_q_s_a - nn_q_s_a
-                      << " "
-                      << q_q_s_a
-                      << " "
-                      << nn_q_s_a
-                      << std::endl;
-#ifdef FEELINGS
-            std::cerr << "###Feelings "
-                      << q_q_s_a_f - nn_q_s_a_f
-                      << " "
-                      << q_q_s_a_f
-                      << " "
-                      << nn_q_s_a_f
-                      << std::endl;
-#endif
-#endif
-		      
-            if ( std::fabs ( old_q_q_s_a_nn_q_s_a - ( q_q_s_a - nn_q_s_a ) ) <= 0.0000000001 )
-              break;
+            out.begin();
+            header.trunk = out.tell();
+            copy_block ( files[trunkBlock.file], trunkBlock.base, trunkBlock.offset, trunkBlock.crc, real_size, out );
+            header.trunk_size = out.tell() - header.trunk;
+            header.trunk_crc = out.checksum();
+            out.align();
+          }
 
-            old_q_q_s_a_nn_q_s_a = q_q_s_a - nn_q_s_a;
+        std::vector<uint64_t> offsets;
+        std::vector<uint32_t> crcs;
 
+        for ( std::map<SPOTriplet, Block>::iterator it=blocks.begin(); it!=blocks.end(); ++it )
+          {
+            out.begin();
+            offsets.push_back ( out.tell() );
+            copy_block ( files[it->second.file], it->second.base, it->second.offset, it->second.crc, real_size, out );
+            crcs.push_back ( out.checksum() );
+            out.align();
           }
 
-        action = argmax_ap_f ( prg, image );
-#ifdef FEELINGS
-        feeling = argmax_ap_f_f ( prg, image );
-#endif
+        out.begin();
+        header.table = out.tell();
+        std::size_t a {0};
+        for ( std::map<SPOTriplet, Block>::iterator it=blocks.begin(); it!=blocks.end(); ++it, ++a )
+          {
+            put ( out, it->first );
+            out.put<uint64_t> ( offsets[a] );
+            out.put<uint32_t> ( crcs[a] );
+          }
+        header.table_size = out.tell() - header.table;
+        header.table_crc = out.checksum();
+        out.align();
+
+        out.begin();
+        header.frqs = out.tell();
+        put_frqs ( out, f, std::vector<double>() );
+        header.frqs_size = out.tell() - header.frqs;
+        header.frqs_crc = out.checksum();
+
+        std::memcpy ( header.magic, soul_magic, sizeof ( header.magic ) );
+        header.version = soul_version;
+        header.real_size = real_size;
+        header.n_prcps = blocks.size();
+        header.journal = journal;
+        header.header_crc = crc32c ( 0, &header, offsetof ( SoulHeader, header_crc ) );
+
+        samuFile.seekp ( 0 );
+        samuFile.write ( reinterpret_cast<const char *> ( &header ), sizeof ( header ) );
+        samuFile.close();
+
+        if ( !samuFile || std::rename ( tmp.c_str(), fname.c_str() ) )
+          throw "The soul cannot be written.";
+
+        std::remove ( old.c_str() );
       }
-
-    prev_state = prg; 		// s <- s'
-    prev_reward = reward;	// r <- r'
-    prev_action = action;	// a <- a'
-#ifdef FEELINGS
-    prev_feeling = feeling;	// a <- a'
-#endif
-
-#ifdef PLACE_VALUE
-    std::memcpy ( prev_image, image, 10*3*sizeof ( double ) );
-#elif FOUR_TIMES
-    std::memcpy ( prev_image, image, 2*10*2*80*sizeof ( double ) );
-#elif CHARACTER_CONSOLE
-    std::memcpy ( prev_image, image, 10*80*sizeof ( double ) );
-#else
-    std::memcpy ( prev_image, image, 256*256*sizeof ( double ) );
-#endif
-    return action;
-  }
-
-#else
-
-  double max_ap_Q_sp_ap ( std::string prg )
-  {
-    double q_spap;
-    double min_q_spap = -std::numeric_limits<double>::max();
-
-    for ( std::map<SPOTriplet, std::map<std::string, double>>::iterator it=table_.begin(); it!=table_.end(); ++it )
+    catch ( const char * err )
       {
-        q_spap = it->second[prg];
-        if ( q_spap > min_q_spap )
-          min_q_spap = q_spap;
+        std::remove ( tmp.c_str() );
+        std::cerr << "Compacting the journal of "
+                  << fname
+                  << ": "
+                  << err
+                  << std::endl;
       }
-
-    return min_q_spap;
   }
 
-  SPOTriplet argmax_ap_f ( std::string prg )
+  // a perceptron block of a soul, its checksum is verified while it is copied
+  static void copy_block ( std::fstream & file, std::streamoff base, uint64_t offset, uint32_t crc,
+                           uint32_t real_size, SoulWriter & out )
   {
-    double q_spap;
-    double min_f = -std::numeric_limits<double>::max();
-    SPOTriplet ap;
+    SoulReader in ( file, real_size );
+    in.set_base ( base );
+    in.seek ( offset );
+    in.begin();
+
+    uint32_t n_layers = in.get<uint32_t>();
+
+    if ( n_layers < 2 || n_layers > 64 )
+      throw "The soul is corrupted.";
 
-    for ( std::map<SPOTriplet, std::map<std::string, double>>::iterator it=table_.begin(); it!=table_.end(); ++it )
+    out.put<uint32_t> ( n_layers );
+
+    std::vector<uint32_t> n_units ( n_layers );
+    for ( uint32_t i {0}; i < n_layers; ++i )
       {
+        n_units[i] = in.get<uint32_t>();
+
+        if ( n_units[i] < 1 || n_units[i] > 1 << 24 )
+          throw "The soul is corrupted.";
 
-        q_spap = it->second[prg];
+        out.put<uint32_t> ( n_units[i] );
+      }
 
-        double explor = f ( q_spap, frqs[it->first][prg] );
+    in.align();
+    out.align();
 
-        if ( explor > min_f )
+    std::vector<char> row;
+    for ( uint32_t i {1}; i < n_layers; ++i )
+      {
+        row.resize ( SoulReader::padded ( n_units[i-1], real_size ) * real_size );
+
+        for ( uint32_t j {0}; j < n_units[i]; ++j )
           {
-            min_f = explor;
-            ap = it->first;
+            in.read ( row.data(), row.size() );
+            out.write ( row.data(), row.size() );
           }
       }
 
-    return ap;
+    in.check ( crc, "A perceptron of the soul is corrupted." );
   }
 
-  SPOTriplet operator() ( SPOTriplet triplet, std::string prg )
+  // a perceptron of a soul takes the place of the one of its triplet
+  void adopt ( int triplet, std::unique_ptr<Perceptron> prcp )
   {
+    Perceptron * & p = prcps[triplet];
 
-    // s' = triplet
-    // r' = reward
+#ifdef STORE_PRCPS
+    std::map<int, Spill>::iterator it = spilled.find ( triplet );
+    if ( it != spilled.end() )
+      {
+        free_slots[it->second.size].push_back ( it->second.offset );
+        spilled.erase ( it );
+      }
 
-    double reward =
-      3.0*triplet.cmp ( prev_action ) - 1.5;
+    resident += prcp->footprint();
+    if ( p )
+      resident -= p->footprint();
+#endif
 
-    SPOTriplet action = triplet;
+#ifdef FUSED_PRCPS
+    if ( p )
+      stack.replace ( p, prcp.get() );
+    else
+      stack.add ( prcp.get() );
+#endif
 
-    if ( prev_reward >  -std::numeric_limits<double>::max() )
-      {
+    if ( !p )
+      enlist ( triplet );
 
-        ++frqs[prev_action][prev_state];
+#ifdef PRUNE_PRCPS
+    // a loaded or restored action has a new window to get among the best ones
+    ranked_at[triplet] = step;
+#endif
 
-        table_[triplet][prg] = table_[triplet][prg];
+    delete p;
+    p = prcp.release();
+  }
 
-        double max_ap_q_sp_ap = max_ap_Q_sp_ap ( prg );
+  static void put ( SoulWriter & out, const SPOTriplet & t )
+  {
+    out.put ( t.s );
+    out.put ( t.p );
+    out.put ( t.o );
+  }
 
-        table_[prev_action][prev_state] =
-          table_[prev_action][prev_state] +
-          alpha ( frqs[prev_action][prev_state] ) *
-          ( reward + gamma * max_ap_q_sp_ap - table_[prev_action][prev_state] );
+  static SPOTriplet get_triplet ( SoulReader & in )
+  {
+    SPOTriplet t;
 
-        action = argmax_ap_f ( prg );
+    t.s = in.get_string();
+    t.p = in.get_string();
+    t.o = in.get_string();
 
-      }
+    return t;
+  }
 
-    prev_state = prg; 		// s <- s'
-    prev_reward = reward;   	// r <- r'
-    prev_action = action;	// a <- a'
+  // the visit counts (all or the ones touched since the last checkpoint) by
+  // triplet
+  Frequencies frequencies ( bool delta ) const
+  {
+    Frequencies f;
+    TripletIds & dictionary = TripletIds::get();
 
-    return action;
-  }
+    auto add = [&] ( int action, uint64_t state, int n )
+    {
+      f[dictionary[action]][state] = n;
+    };
 
-#endif
+    if ( delta )
+      frqs.for_each_touched ( add );
+    else
+      frqs.for_each ( add );
 
-  double reward ( void )
-  {
-    return prev_reward;
+    return f;
   }
-#ifdef FEELINGS
-  Feeling feeling ( void )
+
+  // the scalings of a delta in the order they were made, with the
+  // truncation of VisitTable
+  static void scale ( Frequencies & f, const std::vector<double> & factors )
   {
-    return prev_feeling;
+    for ( Frequencies::iterator it=f.begin(); it!=f.end(); ++it )
+      for ( std::map<uint64_t, int>::iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
+        for ( std::size_t i {0}; i < factors.size() && itt->second; ++i )
+          itt->second *= factors[i];
   }
-#endif
-  double alpha ( int n )
+
+  // the frequency table of a soul, the version 1 souls have the text of the
+  // states instead of their fingerprints, from version 3 the table follows
+  // the factors of the scalings of all the earlier counts (a delta)
+  static void get_frqs ( SoulReader & in, uint32_t version, Frequencies & f, std::vector<double> & factors )
   {
-    return 1.0/ ( ( ( double ) n ) + 1.0 );
+    if ( version >= 3 )
+      {
+        factors.resize ( in.get<uint32_t>() );
+        for ( std::size_t i {0}; i < factors.size(); ++i )
+          factors[i] = in.get<double>();
+      }
+
+    uint32_t frqsSize = in.get<uint32_t>();
+    for ( uint32_t s {0}; s < frqsSize; ++s )
+      {
+        std::map<uint64_t, int> & m = f[get_triplet ( in )];
+
+        uint32_t mapSize = in.get<uint32_t>();
+        for ( uint32_t ss {0}; ss < mapSize; ++ss )
+          {
+            uint64_t state = version == 1 ? fingerprint ( in.get_string() ) : in.get<uint64_t>();
+            m[state] = in.get<int32_t>();
+          }
+      }
   }
 
-  void clearn ( void )
+  static void put_frqs ( SoulWriter & out, const Frequencies & f, const std::vector<double> & factors )
   {
+    out.put<uint32_t> ( factors.size() );
+    for ( std::size_t i {0}; i < factors.size(); ++i )
+      out.put<double> ( factors[i] );
 
-    for ( std::map<SPOTriplet, std::map<std::string, int>>::iterator it=frqs.begin(); it!=frqs.end(); ++it )
+    out.put<uint32_t> ( f.size() );
+
+    for ( Frequencies::const_iterator it=f.begin(); it!=f.end(); ++it )
       {
+        put ( out, it->first );
+        out.put<uint32_t> ( it->second.size() );
 
-        for ( std::map<std::string, int>::iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
+        for ( std::map<uint64_t, int>::const_iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
           {
-            itt->second = 0;
+            out.put<uint64_t> ( itt->first );
+            out.put<int32_t> ( itt->second );
           }
       }
-
   }
+#endif
 
-  double sigmoid ( int n )
+#ifdef SPILL_PRCPS
+  // the memory budget of the resident perceptrons in megabytes (SAMU_MEMORY)
+  static std::size_t budget ( void )
   {
-    return 1.0/ ( 1.0 + exp ( -n ) );
+    const char * n = std::getenv ( "SAMU_MEMORY" );
+
+    if ( n && std::atol ( n ) > 0 )
+      return std::atol ( n ) * ( std::size_t {1} << 20 );
+
+    return std::size_t {2048} << 20;
   }
 
-  void scalen ( double s )
+  // Spills the least recently used perceptrons, those of the less frequent
+  // actions first, until the resident ones fit into 7/8 of the budget. A
+  // perceptron is used when its action is observed or learnt; the spilled
+  // ones are left out of the max and the argmax until they are used again.
+  void evict ( int keep, int keep2 )
   {
+    if ( resident <= memory )
+      return;
 
-    for ( std::map<SPOTriplet, std::map<std::string, int>>::iterator it=frqs.begin(); it!=frqs.end(); ++it )
+    std::vector<std::pair<std::pair<unsigned long, long>, int>> victims;
+
+    for ( std::vector<int>::iterator it=ids.begin(); it!=ids.end(); ++it )
       {
+        if ( *it == keep || *it == keep2 )
+          continue;
 
-        for ( std::map<std::string, int>::iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
-          {
-            //itt->second -= ( itt->second / 5 );
-            itt->second *= s;
-          }
+        long n = frqs.total ( *it );
+
+        victims.push_back ( std::make_pair ( std::make_pair ( used[*it], n ), *it ) );
       }
 
+    // the ties are broken in the order of the triplets
+    std::stable_sort ( victims.begin(), victims.end(),
+                       [] ( const std::pair<std::pair<unsigned long, long>, int> & a,
+                            const std::pair<std::pair<unsigned long, long>, int> & b )
+    {
+      return a.first < b.first;
+    } );
+
+    for ( std::size_t a {0}; a < victims.size() && resident > memory / 8 * 7; ++a )
+      spill ( victims[a].second );
+
+    reorder();
   }
+#endif
 
-  void save_prcps ( std::fstream & samuFile )
+#ifdef STORE_PRCPS
+  // the perceptron of the triplet is written into the store and deleted
+  void spill ( int triplet )
   {
-    samuFile << prcps.size();
+    Perceptron * p = prcps[triplet];
 
-    int prev_p {0};
-    for ( std::map<SPOTriplet, Perceptron*>::iterator it=prcps.begin(); it!=prcps.end(); ++it )
+    std::ostringstream block;
+    SoulWriter out ( block );
+    p->save ( out );
+    std::string data = block.str();
+
+    if ( !store.is_open() )
       {
-        int p = ( std::distance ( prcps.begin(), it ) * 100 ) / prcps.size();
-        if ( p > prev_p+9 )
-          {
-            std::cerr << "Saving Samu: "
-                      << p
-                      << "% (perceptrons)"
-                      << std::endl;
-            prev_p = p;
-          }
-        samuFile << " "
-                 << it->first;
-        it->second->save ( samuFile );
+        char name[] {"samu.spill.XXXXXX"};
+        int fd = mkstemp ( name );
+
+        if ( fd == -1 )
+          throw "The store of the perceptrons cannot be created.";
+
+        close ( fd );
+        spill_name = name;
+        store.open ( spill_name, std::ios_base::in | std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+      }
+
+    // the free slots are not reused while a snapshot may still copy them
+    uint64_t offset = store_end;
+    std::vector<uint64_t> & slots = free_slots[data.size()];
+    if ( !slots.empty() && !snapshotting() )
+      {
+        offset = slots.back();
+        slots.pop_back();
       }
+    else
+      store_end += data.size();
+
+    store.seekp ( offset );
+    store.write ( data.data(), data.size() );
+    store.flush();
+
+    if ( !store )
+      throw "The perceptrons cannot be spilled.";
+
+    spilled[triplet] = Spill {offset, data.size(), out.checksum() };
+
+#ifdef FUSED_PRCPS
+    stack.remove ( p );
+#endif
+
+    resident -= p->footprint();
+    ++stats.spills;
+    stats.spilled_bytes += data.size();
+
+    delete p;
+    prcps[triplet] = nullptr;
+    delist ( triplet );
   }
 
-  void save_frqs ( std::fstream & samuFile )
+  // the perceptron of the triplet is read back from the store
+  void fetch ( int triplet )
   {
-    samuFile << std::endl
-             << frqs.size();
+    if ( triplet < 0 )
+      return;
 
-    int prev_p {0};
-    for ( std::map<SPOTriplet, std::map<std::string, int>>::iterator it=frqs.begin(); it!=frqs.end(); ++it )
+    used[triplet] = step;
+
+    if ( prcps[triplet] )
       {
+        ++stats.hits;
+        return;
+      }
 
-        int p = ( std::distance ( frqs.begin(), it ) * 100 ) / frqs.size();
-        if ( p > prev_p+9 )
-          {
-            std::cerr << "Saving Samu: "
-                      << p
-                      << "% (frequency table)"
-                      << std::endl;
-            prev_p = p;
-          }
+    std::map<int, Spill>::iterator it = spilled.find ( triplet );
+    if ( it == spilled.end() )
+      return;
 
-        samuFile << " "
-                 << it->first
-                 << " "
-                 << it->second.size();
-        for ( std::map<std::string, int>::iterator itt=it->second.begin(); itt!=it->second.end(); ++itt )
-          {
-            samuFile << " "
-                     << itt->first
-                     << " "
-                     << itt->second;
-          }
-      }
+    SoulReader in ( store, sizeof ( Real ) );
+    in.seek ( it->second.offset );
+    in.begin();
+#ifdef TRUNK_PRCPS
+    std::unique_ptr<Perceptron> prcp ( new Perceptron ( in, trunk ) );
+#else
+    std::unique_ptr<Perceptron> prcp ( new Perceptron ( in ) );
+#endif
+    in.check ( it->second.crc, "A spilled perceptron is corrupted." );
+
+    ++stats.misses;
+    stats.reloaded_bytes += it->second.size;
+#ifdef PRUNE_PRCPS
+    if ( retired.erase ( triplet ) )
+      ++stats.restored;
+#endif
 
+    adopt ( triplet, std::move ( prcp ) );
+    reorder();
   }
+#endif
 
-  void save ( std::string & fname )
+#ifdef PRUNE_PRCPS
+  // the actions with the prune_rank greatest Q values of the step
+  void rank ( void )
   {
-    std::fstream samuFile ( fname,  std::ios_base::out );
+    std::size_t n = std::min ( prune_rank, ranked.size() );
 
-    save_prcps ( samuFile );
-    save_frqs ( samuFile );
+    std::partial_sort ( ranked.begin(), ranked.begin() + n, ranked.end(),
+                        [] ( const std::pair<double, int> & a,
+                             const std::pair<double, int> & b )
+    {
+      return a.first > b.first;
+    } );
 
-    samuFile.close();
+    for ( std::size_t a {0}; a < n; ++a )
+      ranked_at[ranked[a].second] = step;
   }
 
-  void load_prcps ( std::fstream & file )
+  // Retires the actions that have not been among the best ones for
+  // prune_window steps and have been taken less than prune_visits times.
+  // They are archived in the store and restored when their triplet comes
+  // again, so the sweep of a step runs only over the living actions.
+  void prune ( int keep, int keep2 )
   {
-    int prcpsSize {0};
-    file >> prcpsSize;
+    std::vector<int> victims;
 
-    int prev_p {0};
-    SPOTriplet t;
-    for ( int s {0}; s< prcpsSize; ++s )
+    for ( std::vector<int>::iterator it=ids.begin(); it!=ids.end(); ++it )
       {
-        int p = ( s * 100 ) / prcpsSize;
-        if ( p > prev_p+9 )
-          {
-            std::cerr << "Loading Samu: "
-                      << p
-                      << "% (perceptrons)"
-                      << std::endl;
-            prev_p = p;
-          }
+        if ( *it == keep || *it == keep2 )
+          continue;
 
+        if ( step - ranked_at[*it] <= prune_window )
+          continue;
 
-        file >> t;
+        long n = frqs.total ( *it );
+
+        if ( n < prune_visits )
+          victims.push_back ( *it );
+      }
+
+    if ( victims.empty() )
+      return;
 
-        prcps[t] = new Perceptron ( file );
+    for ( std::vector<int>::iterator it=victims.begin(); it!=victims.end(); ++it )
+      {
+        spill ( *it );
+        retired.insert ( *it );
+        ++stats.retired;
       }
 
+    reorder();
   }
+#endif
 
-  void load_frqs ( std::fstream & file )
+#ifdef REPLAY_PRCPS
+  // The replay thread learns replay_batch recorded transitions after each
+  // step of the learner, while the next sentence is being made. The targets
+  // are those of the learner, Q(s, a) + alpha ( n ) * ( r + gamma * max
+  // Q(s', a') - Q(s, a) ), computed again with the current weights and
+  // visits. Without the blending by alpha the often replayed pairs were
+  // pushed past the steps of the learner and the learning did not converge.
+  // The targets are computed one transition at a time with the model lock
+  // released in between, so a step of the learner waits for one max at
+  // most. The sampled transitions are copied first, the learner may
+  // overwrite their slots meanwhile. The transitions of an action are
+  // learnt together (learning_batch), the heads of a trunk learn them one by
+  // one. The transitions of the spilled and the retired actions are skipped.
+  void replaying ( void )
   {
-    int frqsSize {0};
-    file >> frqsSize;
+#ifndef RND_DEBUG
+    std::random_device init;
+    std::default_random_engine gen {init() };
+#else
+    std::default_random_engine gen;
+#endif
 
-    int prev_pc {0};
-    int mapSize {0};
-    SPOTriplet t;
-    std::string p;
-    int n;
-    for ( int s {0}; s< frqsSize; ++s )
+    const int n = sizeof ( prev_image ) / sizeof ( prev_image[0] );
+    std::vector<int> taken;
+    std::vector<uint64_t> states;
+    std::vector<double> rewards;
+    std::vector<double> targets;
+    std::vector<Real> images;
+    std::vector<Real> nexts;
+    std::vector<int> batch;
+    std::vector<int> starts;
+    std::vector<Real *> inputs;
+    std::vector<double> batch_targets;
+    std::vector<double> q;
+    ActiveInputs image_active;
+    ActiveInputs next_active;
+    ActiveInputs dense;
+
+    std::unique_lock<std::mutex> lock ( model );
+
+    for ( ;; )
       {
+        replay_wake.wait ( lock, [this] { return replay_stop || replays > 0; } );
 
-        int pc = ( s * 100 ) / frqsSize;
-        if ( pc > prev_pc+9 )
+        if ( replay_stop )
+          return;
+
+        --replays;
+
+        taken.resize ( replay_batch );
+        states.resize ( replay_batch );
+        rewards.resize ( replay_batch );
+        targets.resize ( replay_batch );
+        images.resize ( replay_batch * n );
+        nexts.resize ( replay_batch * n );
+
+        for ( std::size_t b {0}; b < replay_batch; ++b )
           {
-            std::cerr << "Loading Samu: "
-                      << pc
-                      << "% (frequency table)"
-                      << std::endl;
-            prev_pc = pc;
+            const Transition & t = experience.sample ( gen );
+
+            taken[b] = t.action;
+            states[b] = t.state;
+            rewards[b] = t.reward;
+            t.image.restore ( &images[b * n] );
+            t.next.restore ( &nexts[b * n] );
           }
 
-        file >> t;
-        file >> mapSize;
-        for ( int ss {0}; ss< mapSize; ++ss )
+        for ( std::size_t b {0}; b < replay_batch; ++b )
           {
-            file >> p;
-            file >> n;
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+
+            if ( replay_stop )
+              return;
+
+            if ( taken[b] >= ( int ) prcps.size() || !prcps[taken[b]] )
+              {
+                taken[b] = -1;
+                continue;
+              }
+
+            next_active ( &nexts[b * n], n );
+            double max_ap_q_sp_ap = max_ap_Q_sp_ap ( &nexts[b * n], next_active, --replay_stamp, q );
+
+            image_active ( &images[b * n], n );
+            double nn_q_s_a = ( *prcps[taken[b]] ) ( &images[b * n], image_active, --replay_stamp );
+
+            targets[b] = nn_q_s_a +
+                         alpha ( frqs.get ( taken[b], states[b] ) ) *
+                         ( rewards[b] + gamma * max_ap_q_sp_ap - nn_q_s_a );
+          }
+
+        batch.clear();
+        for ( std::size_t b {0}; b < replay_batch; ++b )
+          if ( taken[b] >= 0 && taken[b] < ( int ) prcps.size() && prcps[taken[b]] )
+            batch.push_back ( b );
+
+        std::stable_sort ( batch.begin(), batch.end(), [&] ( int a, int b )
+        {
+          return taken[a] < taken[b];
+        } );
+
+        starts.clear();
+        for ( std::size_t b {0}; b < batch.size(); ++b )
+          if ( !b || taken[batch[b]] != taken[batch[b-1]] )
+            starts.push_back ( b );
+        starts.push_back ( batch.size() );
+
+        inputs.resize ( batch.size() );
+        batch_targets.resize ( batch.size() );
 
-            frqs[t][p] = n;
+        for ( std::size_t b {0}; b < batch.size(); ++b )
+          {
+            inputs[b] = &images[batch[b] * n];
+            batch_targets[b] = targets[batch[b]];
           }
+
+        auto learn = [&] ( int g )
+        {
+          Perceptron & p = *prcps[taken[batch[starts[g]]]];
+
+#ifdef TRUNK_PRCPS
+          // the hidden units of the trunk are computed for each image
+          for ( int b = starts[g]; b < starts[g+1]; ++b )
+            p.learning ( inputs[b], batch_targets[b], p ( inputs[b], dense ) );
+#else
+          p.learning_batch ( &inputs[starts[g]], &batch_targets[starts[g]], starts[g+1] - starts[g] );
+#endif
+        };
+
+#if defined(POOL_PRCPS) && !defined(TRUNK_PRCPS)
+        // the actions learn in parallel
+        pool ( starts.size() - 1, learn );
+#else
+        for ( std::size_t g {0}; g + 1 < starts.size(); ++g )
+          learn ( g );
+#endif
+
+        for ( std::size_t b {0}; b < batch.size(); ++b )
+          dirty.insert ( taken[batch[b]] );
       }
   }
+#endif
+
+  // the ID of the triplet, the per-action vectors grow with the dictionary
+  int intern ( const SPOTriplet & triplet )
+  {
+    int id = TripletIds::get() ( triplet );
+
+    if ( id >= ( int ) known() )
+      {
+#ifdef Q_LOOKUP_TABLE
+        table_.resize ( id + 1 );
+        enlist ( id );
+#else
+        prcps.resize ( id + 1, nullptr );
+#ifdef STORE_PRCPS
+        used.resize ( id + 1, 0ul );
+#endif
+#ifdef PRUNE_PRCPS
+        ranked_at.resize ( id + 1, step );
+#endif
+#endif
+      }
 
+    return id;
+  }
 
-  void load ( std::fstream & file )
+  // the number of the IDs the per-action vectors have room for
+  std::size_t known ( void ) const
   {
-    load_prcps ( file );
-    load_frqs ( file );
+#ifdef Q_LOOKUP_TABLE
+    return table_.size();
+#else
+    return prcps.size();
+#endif
   }
 
-  int get_N_e ( void ) const
+  // the action of the triplet gets a perceptron (or a column of the lookup
+  // table), it is inserted into ids
+  void enlist ( int triplet )
   {
-    return N_e;
+    TripletIds & dictionary = TripletIds::get();
+
+    ids.insert ( std::lower_bound ( ids.begin(), ids.end(), triplet, [&] ( int a, int b )
+    {
+      return dictionary.less ( a, b );
+    } ), triplet );
   }
 
-  void set_N_e ( int N_e )
+#ifndef Q_LOOKUP_TABLE
+  // a perceptron of a new action, from the warm pool if there is one
+  Perceptron * fresh ( const std::vector<int> & topology )
   {
-    this->N_e = N_e;
+#ifdef WARM_PRCPS
+    return warm ( topology );
+#else
+    return new Perceptron ( topology );
+#endif
   }
 
-  double get_max_reward ( void ) const
+  // the perceptrons (and the slots of the stack) in the order of ids
+  void reorder ( void )
   {
-    return max_reward;
+    actions.clear();
+#ifdef FUSED_PRCPS
+    order.clear();
+#endif
+
+    for ( std::vector<int>::iterator it=ids.begin(); it!=ids.end(); ++it )
+      {
+        actions.push_back ( prcps[*it] );
+#ifdef FUSED_PRCPS
+        order.push_back ( stack.slot ( prcps[*it] ) );
+#endif
+      }
   }
 
-  double get_min_reward ( void ) const
+  void delist ( int triplet )
   {
-    return min_reward;
+    ids.erase ( std::find ( ids.begin(), ids.end(), triplet ) );
   }
 
+#ifdef POOL_PRCPS
+  // q[a] = Q value of the a-th action on the image, the perceptrons are
+  // shared out among the threads of the pool
+  void sweep ( Real image[], const ActiveInputs & active, unsigned long stamp, std::vector<double> & q )
+  {
+    q.resize ( actions.size() );
 
-private:
+    pool ( actions.size(), [&] ( int a )
+    {
+      q[a] = ( *actions[a] ) ( image, active, stamp );
+    } );
+  }
+#endif
+#endif
 
   int N_e = 30;
 
   QL ( const QL & );
   QL & operator= ( const QL & );
 
+  // The steps of the learner and of the caregiver shell, the checkpoints
+  // and the snapshots take turns on the model.
+  std::mutex model;
+
 #ifdef Q_LOOKUP_TABLE
   double gamma = .2;
 #else
   double gamma = .2;
 #endif
 
+  // the IDs of the actions in the order of their triplets, so the ties of
+  // the argmax go to the first triplet (the lookup table has all the seen
+  // triplets, the perceptrons only those with perceptrons)
+  std::vector<int> ids;
+
 #ifdef Q_LOOKUP_TABLE
-  std::map<SPOTriplet, std::map<std::string, double>> table_;
+  QTable table_;
 #else
-  std::map<SPOTriplet, Perceptron*> prcps;
+  // the perceptrons of the actions by the IDs of their triplets, nullptr if
+  // the triplet has no perceptron or it is spilled
+  std::vector<Perceptron*> prcps;
+#ifdef TRUNK_PRCPS
+  Perceptron * trunk {nullptr};
+#endif
+#ifdef MMAP_SOUL
+  // the souls the perceptrons are mapped from, they are unmapped after the
+  // perceptrons are deleted
+  std::vector<std::unique_ptr<SoulMapping>> mappings;
+#endif
+#ifdef STORE_PRCPS
+  // the spilled perceptrons with the offsets, sizes and checksums of their
+  // blocks in the store, a file of perceptron blocks beside the soul
+  struct Spill
+  {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t crc;
+  };
+
+  std::map<int, Spill> spilled;
+  std::map<uint64_t, std::vector<uint64_t>> free_slots;
+  // the step of the last use
+  std::vector<unsigned long> used;
+  std::fstream store;
+  std::string spill_name;
+  uint64_t store_end {0};
+  std::size_t resident {0};
+  StoreStats stats;
+#endif
+#ifdef SPILL_PRCPS
+  std::size_t memory {budget() };
+#endif
+#ifdef PRUNE_PRCPS
+  // the pruning policy, an action is retired after prune_window steps out of
+  // the prune_rank best ones if it has been taken less than prune_visits times
+  std::size_t prune_rank {8};
+  unsigned long prune_window {5000};
+  long prune_visits {10};
+  unsigned long prune_every {1000};
+  std::vector<std::pair<double, int>> ranked;
+  // the step the action was last among the best ones, or the step it came
+  // (interned, loaded or restored) if it has not been since
+  std::vector<unsigned long> ranked_at;
+  std::set<int> retired;
+#endif
+  std::vector<Perceptron*> actions;
+  std::vector<double> qs;
+#ifdef FUSED_PRCPS
+  PerceptronStack stack;
+  std::vector<int> order;
+#endif
+#ifdef POOL_PRCPS
+  ThreadPool pool;
+#endif
+#ifdef WARM_PRCPS
+  PerceptronPool warm;
+#endif
+#ifdef REPLAY_PRCPS
+  // the replay policy, replay_batch transitions are learnt replay_ratio
+  // times after each step of the learner
+  ReplayBuffer experience {1024};
+  std::size_t replay_batch {16};
+  int replay_ratio {1};
+  int replays {0};
+  // the stamps of the replayed images count down from the top, the steps
+  // of the learner count up, so their memoized Q values never mix
+  unsigned long replay_stamp {~0ul};
+  std::condition_variable replay_wake;
+  bool replay_stop {false};
+  std::thread replayer;
+#endif
 #ifdef FEELINGS
   std::map<Feeling, Perceptron*> prcps_f;
 #endif
+#endif
 #ifdef QNN_DEBUG
+  // the lookup table keeps it 0
   double relevance {0.0};
 #ifdef FEELINGS
   double relevance_f {0.0};
 #endif
-#endif
 #endif
 
-  std::map<SPOTriplet, std::map<std::string, int>> frqs;
+  VisitTable frqs;
 #ifdef FEELINGS
-  std::map<Feeling, std::map<std::string, int>> frqs_f;
+  std::map<Feeling, std::map<uint64_t, int>> frqs_f;
 #endif
-  SPOTriplet prev_action;
+  // the triplets whose perceptrons or frequencies have changed since the
+  // last checkpoint
+  std::set<int> dirty;
+  // the factors of the scalings of all the counts since the last checkpoint
+  std::vector<double> scalings;
+  uint32_t last_delta {0};
+  std::thread compactor;
+  std::atomic<bool> compacting {false};
+  // the process writing a snapshot
+  pid_t saver {0};
+  int prev_action {-1};
 #ifdef FEELINGS
   Feeling prev_feeling {"Hello, World!"};
 #endif
-  std::string prev_state;
+  uint64_t prev_state {empty_state};
 
   double prev_reward { -std::numeric_limits<double>::max() };
   double max_reward { 1.1 };
   double min_reward {-1.1*max_reward};
 
 #ifdef PLACE_VALUE
-  double prev_image [10*3];
+  Real prev_image [10*3];
 #elif FOUR_TIMES
-  double prev_image [2*10*2*80];
+  Real prev_image [2*10*2*80];
 #elif CHARACTER_CONSOLE
-  double prev_image [10*80];
+  Real prev_image [10*80];
 #else
-  double prev_image [256*256];
+  Real prev_image [256*256];
+#endif
+
+#ifndef Q_LOOKUP_TABLE
+  ActiveInputs active;
+  ActiveInputs prev_active;
+  unsigned long step {0};
+#ifdef INT8_PRCPS
+  QuantizedInputs qinput;
+  // toggled by the caregiver shell while the learner runs
+  std::atomic<bool> inference {false};
+#endif
 #endif
 
 };
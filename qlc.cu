@@ -54,24 +54,24 @@ sigmoid ( double x )
 }
 
 __device__ double
-prcp ( int j, int nu, double *newu, double *u, double *w )
+prcp ( int j, int nu, int stride, double *newu, double *u, double *w )
 {
     newu[j] = 0.0;
     for ( int k = 0; k < nu; ++k ) {
-        newu[j] += w[j*nu+k] * u[k];
+        newu[j] += w[j*stride+k] * u[k];
     }
     return sigmoid ( newu[j] );
 }
 
 __global__ void
-layer_kernel ( int nu, double *newu, double *u, double *w )
+layer_kernel ( int nu, int stride, double *newu, double *u, double *w )
 {
     //int j = blockIdx.x;
     int j = threadIdx.x;
-    newu[j] = prcp ( j, nu, newu, u, w );
+    newu[j] = prcp ( j, nu, stride, newu, u, w );
 }
 
-void cuda_layer ( int i, int* n_units,   double **units,   double ***weights )
+void cuda_layer ( int i, int* n_units,   double **units,   double *weights, int stride )
 {
     double *device_newu;
     cudaMalloc ( ( void ** ) &device_newu, n_units[i] * sizeof ( double ) );
@@ -82,20 +82,17 @@ void cuda_layer ( int i, int* n_units,   double **units,   double ***weights )
                  n_units[i-1]*sizeof ( double ), cudaMemcpyHostToDevice );
 
     double *device_w;
-    cudaMalloc ( ( void ** ) &device_w, n_units[i] * n_units[i-1] * sizeof ( double ) );
-    for ( int wi = 0; wi<n_units[i]; ++wi ) {
-
-        cudaMemcpy ( device_w+wi*n_units[i-1], weights[i-1][wi],
-                     n_units[i-1]*sizeof ( double ), cudaMemcpyHostToDevice );
-    }
+    cudaMalloc ( ( void ** ) &device_w, n_units[i] * stride * sizeof ( double ) );
+    cudaMemcpy ( device_w, weights,
+                 n_units[i]*stride*sizeof ( double ), cudaMemcpyHostToDevice );
     ///*
     dim3 grid ( 1, 1 );
     dim3 tgrid ( n_units[i] , 1 );
-    layer_kernel <<< grid, tgrid >>> ( n_units[i-1], device_newu, device_u, device_w );
+    layer_kernel <<< grid, tgrid >>> ( n_units[i-1], stride, device_newu, device_u, device_w );
     //*/
     /*
     dim3 grid ( n_units[i] , 1 );
-    layer_kernel <<< grid, 1 >>> ( n_units[i-1], device_newu, device_u, device_w );
+    layer_kernel <<< grid, 1 >>> ( n_units[i-1], stride, device_newu, device_u, device_w );
     */
     cudaMemcpy ( units[i], device_newu,
                  n_units[i]*sizeof ( double ), cudaMemcpyDeviceToHost );
@@ -48,6 +48,6 @@
  * 
  */
 
-void cuda_layer(int i, int* n_units,   double **units,   double ***weights);
+void cuda_layer(int i, int* n_units,   double **units,   double *weights, int stride);
 
 #endif
@@ -125,6 +125,10 @@ void Samu::FamilyCaregiverShell ( void )
           if ( !line.compare ( 0, cmd_prefix.length(), cmd_prefix ) )
             {
               std::string readCmd {"cmd read"};
+              std::string saveCmd {"cmd save"};
+#ifdef INT8_PRCPS
+              std::string inferenceCmd {"cmd inference"};
+#endif
 
               size_t f = line.find ( readCmd );
               if ( f != std::string::npos )
@@ -136,6 +140,18 @@ void Samu::FamilyCaregiverShell ( void )
                       set_training_file ( fname );
                     }
                 }
+              else if ( line.find ( saveCmd ) != std::string::npos )
+                {
+                  save_ = true;
+                  disp.log ( "I will save my soul." );
+                }
+#ifdef INT8_PRCPS
+              else if ( line.find ( inferenceCmd ) != std::string::npos )
+                {
+                  set_inference ( !get_inference() );
+                  disp.log ( get_inference() ? "I am not learning now." : "I am learning now." );
+                }
+#endif
               else
                 NextCaregiver();
             }
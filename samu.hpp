@@ -55,6 +55,7 @@
 #include <thread>
 #include <condition_variable>
 #include <mutex>
+#include <atomic>
 
 #include "nlp.hpp"
 
@@ -230,6 +231,8 @@ public:
     return vi.reward();
   }
 
+#ifndef Q_LOOKUP_TABLE
+  // the lookup table has no soul
   void save ( std::string & fname )
   {
 #ifdef DISP_CURSES
@@ -240,15 +243,45 @@ public:
     vi.save ( fname );
   }
 
-  void load ( std::fstream & file )
+  // a delta of the soul since the previous checkpoint
+  void checkpoint ( std::string & fname )
+  {
+    vi.checkpoint ( fname );
+  }
+
+  // a consistent copy of the soul written in the background
+  void snapshot ( std::string & fname )
+  {
+    vi.snapshot ( fname );
+  }
+
+  // a snapshot asked by the caregiver (cmd save), it is taken by the learner
+  bool save_requested ( void )
+  {
+    return save_.exchange ( false );
+  }
+
+  // the text soul of the earlier versions becomes the binary soul fname
+  void convert ( std::fstream & file, std::string & fname )
+  {
+#ifdef DISP_CURSES
+    disp.log ( "Loading Samu..." );
+#else
+    std::cerr << "Loading Samu..." << std::endl;
+#endif
+    vi.convert ( file, fname );
+  }
+
+  void load ( std::string & fname )
   {
 #ifdef DISP_CURSES
     disp.log ( "Loading Samu..." );
 #else
     std::cerr << "Loading Samu..." << std::endl;
 #endif
-    vi.load ( file );
+    vi.load ( fname );
   }
+#endif
 
   std::string get_training_file() const
   {
@@ -265,6 +298,18 @@ public:
     vi.set_N_e ( N_e );
   }
 
+#ifdef INT8_PRCPS
+  void set_inference ( bool inference )
+  {
+    vi.set_inference ( inference );
+  }
+
+  bool get_inference ( void ) const
+  {
+    return vi.get_inference();
+  }
+#endif
+
   void clear_N_e ( void )
   {
     vi.clearn();
@@ -285,6 +330,13 @@ public:
     return vi.brel();
   }
 
+#ifdef STORE_PRCPS
+  const QL::StoreStats & get_store_stats ( void )
+  {
+    return vi.store_stats();
+  }
+#endif
+
   double get_max_reward ( void ) const
   {
     return vi.get_max_reward();
@@ -368,7 +420,8 @@ private:
 
 #ifndef Q_LOOKUP_TABLE
 
-      std::string prg;
+      // the state is known by the fingerprint of the program
+      uint64_t prg {empty_state};
       stmt_counter = 0;
 #ifdef PYRAMID_VI
       SPOTriplets pyramid;
@@ -382,9 +435,9 @@ private:
         {
           auto triplet = run.front();
 
-          prg += triplet.s.c_str();
-          prg += triplet.p.c_str();
-          prg += triplet.o.c_str();
+          prg = fingerprint ( triplet.s, prg );
+          prg = fingerprint ( triplet.p, prg );
+          prg = fingerprint ( triplet.o, prg );
 
 #ifdef PLACE_VALUE
 
@@ -550,14 +603,14 @@ private:
 #endif
 
 #else
-      std::string prg;
+      uint64_t prg {empty_state};
       while ( !run.empty() )
         {
           auto triplet = run.front();
 
-          prg += triplet.s.c_str();
-          prg += triplet.p.c_str();
-          prg += triplet.o.c_str();
+          prg = fingerprint ( triplet.s, prg );
+          prg = fingerprint ( triplet.p, prg );
+          prg = fingerprint ( triplet.o, prg );
 
           run.pop();
         }
@@ -625,15 +678,32 @@ private:
       return ql.reward();
     }
 
+#ifndef Q_LOOKUP_TABLE
     void save ( std::string &fname )
     {
       ql.save ( fname );
     }
 
-    void load ( std::fstream & file )
+    void checkpoint ( std::string & fname )
+    {
+      ql.checkpoint ( fname );
+    }
+
+    void snapshot ( std::string & fname )
+    {
+      ql.snapshot ( fname );
+    }
+
+    void convert ( std::fstream & file, std::string & fname )
+    {
+      ql.convert ( file, fname );
+    }
+
+    void load ( std::string & fname )
     {
-      ql.load ( file );
+      ql.load ( fname );
     }
+#endif
 
     void clear ( void )
     {
@@ -648,6 +718,18 @@ private:
       ql.set_N_e ( N_e );
     }
 
+#ifdef INT8_PRCPS
+    void set_inference ( bool inference )
+    {
+      ql.set_inference ( inference );
+    }
+
+    bool get_inference ( void ) const
+    {
+      return ql.get_inference();
+    }
+#endif
+
     void clearn ( void )
     {
       ql.clearn();
@@ -663,6 +745,13 @@ private:
       return ql.get_action_relevance();
     }
 
+#ifdef STORE_PRCPS
+    const QL::StoreStats & store_stats ( void ) const
+    {
+      return ql.get_store_stats();
+    }
+#endif
+
     double get_max_reward ( void ) const
     {
       return ql.get_max_reward();
@@ -697,6 +786,7 @@ private:
   bool sleep_ {true};
   int sleep_after_ {160};
   unsigned int read_usec_ {50*1000};
+  std::atomic<bool> save_ {false};
   std::mutex mutex_;
   std::condition_variable cv_;
   std::thread terminal_thread_ {&Samu::terminal, this};
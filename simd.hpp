@@ -0,0 +1,604 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+/**
+ * @brief JUDAH - Jacob is equipped with a text-based user interface
+ *
+ * @file simd.hpp
+ * @author  Norbert Bátfai <nbatfai@gmail.com>
+ * @version 0.0.1
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2015 Norbert Bátfai, batfai.norbert@inf.unideb.hu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * JACOB, https://github.com/nbatfai/jacob
+ *
+ * "The son of Isaac is Jacob." The project called Jacob is an experiment
+ * to replace Isaac's (GUI based) visual imagination with a character console.
+ *
+ * ISAAC, https://github.com/nbatfai/isaac
+ *
+ * "The son of Samu is Isaac." The project called Isaac is a case study
+ * of using deep Q learning with neural networks for predicting the next
+ * sentence of a conversation.
+ *
+ * SAMU, https://github.com/nbatfai/samu
+ *
+ * The main purpose of this project is to allow the evaluation and
+ * verification of the results of the paper entitled "A disembodied
+ * developmental robotic agent called Samu Bátfai". It is our hope
+ * that Samu will be the ancestor of developmental robotics chatter
+ * bots that will be able to chat in natural language like humans do.
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+// Vectorized kernels of the forward pass of the perceptrons. A GEMV computes
+// rows dot products of a row-major matrix (whose rows are stride elements
+// apart) and the vector x of length n. The kernels are written once with the
+// vector extension of GCC, for float and double, and they are compiled for
+// SSE2, AVX2+FMA and AVX-512F. The implementation is selected once, at the
+// first call, by the features of the CPU. The SAMU_SIMD environment variable
+// (scalar, sse2, avx2, avx512) may be used to override it.
+
+enum SimdIsa {SCALAR, SSE2, AVX2, AVX512};
+
+inline SimdIsa simd_isa ( void )
+{
+  const char * isa = std::getenv ( "SAMU_SIMD" );
+
+  if ( isa && !std::strcmp ( isa, "scalar" ) )
+    return SCALAR;
+
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+
+  if ( ( !isa || !std::strcmp ( isa, "avx512" ) ) && __builtin_cpu_supports ( "avx512f" ) )
+    return AVX512;
+
+  if ( ( !isa || !std::strcmp ( isa, "avx512" ) || !std::strcmp ( isa, "avx2" ) )
+       && __builtin_cpu_supports ( "avx2" ) && __builtin_cpu_supports ( "fma" ) )
+    return AVX2;
+
+  if ( __builtin_cpu_supports ( "sse2" ) )
+    return SSE2;
+#endif
+
+  return SCALAR;
+}
+
+template <typename T>
+inline void gemv_scalar ( const T * w, int stride, int rows, const T * x, int n, T * y )
+{
+  for ( int j {0}; j < rows; ++j, w += stride )
+    {
+      T u {0};
+
+      for ( int k {0}; k < n; ++k )
+        u += w[k] * x[k];
+
+      y[j] = u;
+    }
+}
+
+// B is the width of the vector registers in bytes
+template <typename T, int B>
+inline void gemv_vec ( const T * w, int stride, int rows, const T * x, int n, T * y )
+{
+  typedef T V __attribute__ ( ( vector_size ( B ) ) );
+  const int m = B / sizeof ( T );
+
+  int j {0};
+
+  for ( ; j + 4 <= rows; j += 4, w += 4*stride )
+    {
+      V a0 {}, a1 {}, a2 {}, a3 {}, xv, wv;
+
+      int k {0};
+      for ( ; k + m <= n; k += m )
+        {
+          std::memcpy ( &xv, x + k, B );
+          std::memcpy ( &wv, w + k, B );
+          a0 += wv * xv;
+          std::memcpy ( &wv, w + stride + k, B );
+          a1 += wv * xv;
+          std::memcpy ( &wv, w + 2*stride + k, B );
+          a2 += wv * xv;
+          std::memcpy ( &wv, w + 3*stride + k, B );
+          a3 += wv * xv;
+        }
+
+      T u0 {0}, u1 {0}, u2 {0}, u3 {0};
+      for ( int i {0}; i < m; ++i )
+        {
+          u0 += a0[i];
+          u1 += a1[i];
+          u2 += a2[i];
+          u3 += a3[i];
+        }
+
+      for ( ; k < n; ++k )
+        {
+          u0 += w[k] * x[k];
+          u1 += w[stride + k] * x[k];
+          u2 += w[2*stride + k] * x[k];
+          u3 += w[3*stride + k] * x[k];
+        }
+
+      y[j] = u0;
+      y[j+1] = u1;
+      y[j+2] = u2;
+      y[j+3] = u3;
+    }
+
+  for ( ; j < rows; ++j, w += stride )
+    {
+      V a {}, xv, wv;
+
+      int k {0};
+      for ( ; k + m <= n; k += m )
+        {
+          std::memcpy ( &xv, x + k, B );
+          std::memcpy ( &wv, w + k, B );
+          a += wv * xv;
+        }
+
+      T u {0};
+      for ( int i {0}; i < m; ++i )
+        u += a[i];
+
+      for ( ; k < n; ++k )
+        u += w[k] * x[k];
+
+      y[j] = u;
+    }
+}
+
+// Sparse GEMV: the vector x is given by its nnz non-zero elements val
+// at the indices idx, so only these columns of the rows are read.
+
+template <typename T>
+inline void spgemv_scalar ( const T * w, int stride, int rows, const int * idx, const T * val, int nnz, T * y )
+{
+  int j {0};
+
+  for ( ; j + 4 <= rows; j += 4, w += 4*stride )
+    {
+      T u0 {0}, u1 {0}, u2 {0}, u3 {0};
+
+      for ( int t {0}; t < nnz; ++t )
+        {
+          const T * c = w + idx[t];
+          u0 += c[0] * val[t];
+          u1 += c[stride] * val[t];
+          u2 += c[2*stride] * val[t];
+          u3 += c[3*stride] * val[t];
+        }
+
+      y[j] = u0;
+      y[j+1] = u1;
+      y[j+2] = u2;
+      y[j+3] = u3;
+    }
+
+  for ( ; j < rows; ++j, w += stride )
+    {
+      T u {0};
+
+      for ( int t {0}; t < nnz; ++t )
+        u += w[idx[t]] * val[t];
+
+      y[j] = u;
+    }
+}
+
+template <typename T, int B>
+inline void spgemv_vec ( const T * w, int stride, int rows, const int * idx, const T * val, int nnz, T * y )
+{
+  typedef T V __attribute__ ( ( vector_size ( B ) ) );
+  const int m = B / sizeof ( T );
+
+  int j {0};
+
+  for ( ; j + 4 <= rows; j += 4, w += 4*stride )
+    {
+      V a0 {}, a1 {}, a2 {}, a3 {}, v, c0 {}, c1 {}, c2 {}, c3 {};
+
+      int t {0};
+      for ( ; t + m <= nnz; t += m )
+        {
+          std::memcpy ( &v, val + t, B );
+
+          for ( int i {0}; i < m; ++i )
+            {
+              const T * c = w + idx[t+i];
+              c0[i] = c[0];
+              c1[i] = c[stride];
+              c2[i] = c[2*stride];
+              c3[i] = c[3*stride];
+            }
+
+          a0 += c0 * v;
+          a1 += c1 * v;
+          a2 += c2 * v;
+          a3 += c3 * v;
+        }
+
+      T u0 {0}, u1 {0}, u2 {0}, u3 {0};
+      for ( int i {0}; i < m; ++i )
+        {
+          u0 += a0[i];
+          u1 += a1[i];
+          u2 += a2[i];
+          u3 += a3[i];
+        }
+
+      for ( ; t < nnz; ++t )
+        {
+          const T * c = w + idx[t];
+          u0 += c[0] * val[t];
+          u1 += c[stride] * val[t];
+          u2 += c[2*stride] * val[t];
+          u3 += c[3*stride] * val[t];
+        }
+
+      y[j] = u0;
+      y[j+1] = u1;
+      y[j+2] = u2;
+      y[j+3] = u3;
+    }
+
+  if ( j < rows )
+    spgemv_scalar ( w, stride, rows - j, idx, val, nnz, y + j );
+}
+
+#ifdef SIMD_X86
+
+template <typename T>
+__attribute__ ( ( target ( "sse2" ), flatten ) )
+void gemv_sse2 ( const T * w, int stride, int rows, const T * x, int n, T * y )
+{
+  gemv_vec<T, 16> ( w, stride, rows, x, n, y );
+}
+
+template <typename T>
+__attribute__ ( ( target ( "avx2,fma" ), flatten ) )
+void gemv_avx2 ( const T * w, int stride, int rows, const T * x, int n, T * y )
+{
+  gemv_vec<T, 32> ( w, stride, rows, x, n, y );
+}
+
+template <typename T>
+__attribute__ ( ( target ( "avx512f" ), flatten ) )
+void gemv_avx512 ( const T * w, int stride, int rows, const T * x, int n, T * y )
+{
+  gemv_vec<T, 64> ( w, stride, rows, x, n, y );
+}
+
+template <typename T>
+__attribute__ ( ( target ( "avx2,fma" ), flatten ) )
+void spgemv_avx2 ( const T * w, int stride, int rows, const int * idx, const T * val, int nnz, T * y )
+{
+  spgemv_vec<T, 32> ( w, stride, rows, idx, val, nnz, y );
+}
+
+template <typename T>
+__attribute__ ( ( target ( "avx512f" ), flatten ) )
+void spgemv_avx512 ( const T * w, int stride, int rows, const int * idx, const T * val, int nnz, T * y )
+{
+  spgemv_vec<T, 64> ( w, stride, rows, idx, val, nnz, y );
+}
+
+#endif
+
+template <typename T>
+inline void gemv ( const T * w, int stride, int rows, const T * x, int n, T * y )
+{
+  typedef void ( *kernel_t ) ( const T *, int, int, const T *, int, T * );
+
+  static const kernel_t kernel = [] () -> kernel_t
+  {
+    switch ( simd_isa() )
+      {
+#ifdef SIMD_X86
+      case AVX512:
+        return gemv_avx512<T>;
+      case AVX2:
+        return gemv_avx2<T>;
+      case SSE2:
+        return gemv_sse2<T>;
+#endif
+      default:
+        return gemv_scalar<T>;
+      }
+  } ();
+
+  kernel ( w, stride, rows, x, n, y );
+}
+
+template <typename T>
+inline void spgemv ( const T * w, int stride, int rows, const int * idx, const T * val, int nnz, T * y )
+{
+  typedef void ( *kernel_t ) ( const T *, int, int, const int *, const T *, int, T * );
+
+  static const kernel_t kernel = [] () -> kernel_t
+  {
+    switch ( simd_isa() )
+      {
+#ifdef SIMD_X86
+      case AVX512:
+        return spgemv_avx512<T>;
+      case AVX2:
+        return spgemv_avx2<T>;
+#endif
+      default:
+        return spgemv_scalar<T>;
+      }
+  } ();
+
+  kernel ( w, stride, rows, idx, val, nnz, y );
+}
+
+// The logistic function y = 1/(1+exp(-x)) of the activations, x and y may
+// be the same array. exp is computed as 2^k p(r), where k is the nearest
+// integer to -x/ln2 and p is the Taylor polynomial of exp on |r| <= ln2/2,
+// of degree 12 for double and of degree 7 for float. The error of p is below
+// 2e-16 and 6e-9 relative, so the result is within a few ulps of the exact
+// value. The argument is clamped to +-lim, the exact function is 0 or 1 there
+// up to 1e-30 absolute error.
+
+template <typename T>
+struct Logistic
+{
+  typedef typename std::conditional<sizeof ( T ) == 8, int64_t, int32_t>::type I;
+
+  static const int degree = sizeof ( T ) == 8 ? 12 : 7;
+  static const int mantissa = sizeof ( T ) == 8 ? 52 : 23;
+  static const int bias = sizeof ( T ) == 8 ? 1023 : 127;
+
+  static constexpr T lim = sizeof ( T ) == 8 ? 700.0 : 80.0;
+  // adding and subtracting it rounds to the nearest integer
+  static constexpr T round = sizeof ( T ) == 8 ? 6755399441055744.0 : 12582912.0;
+  static constexpr T log2e = 1.44269504088896340736;
+  static constexpr T ln2_hi = 0.693359375;
+  static constexpr T ln2_lo = -2.12194440054690582e-4;
+
+  // 1/i!
+  static constexpr T coeff[13] {1.0, 1.0, 1.0/2, 1.0/6, 1.0/24, 1.0/120, 1.0/720, 1.0/5040,
+                                1.0/40320, 1.0/362880, 1.0/3628800, 1.0/39916800, 1.0/479001600
+                               };
+};
+
+template <typename T>
+constexpr T Logistic<T>::coeff[13];
+
+template <typename T>
+inline T logistic ( T x )
+{
+  typedef Logistic<T> L;
+  typedef typename L::I I;
+
+  T z = x > L::lim ? -L::lim : x < -L::lim ? L::lim : -x;
+
+  T t = z * L::log2e + L::round;
+  T k = t - L::round;
+  T r = ( z - k * L::ln2_hi ) - k * L::ln2_lo;
+
+  T p = L::coeff[L::degree];
+  for ( int i {L::degree - 1}; i >= 0; --i )
+    p = p * r + L::coeff[i];
+
+  I tb, rb, e;
+  T round = L::round;
+  std::memcpy ( &tb, &t, sizeof ( T ) );
+  std::memcpy ( &rb, &round, sizeof ( T ) );
+  e = ( tb - rb + L::bias ) << L::mantissa;
+
+  T scale;
+  std::memcpy ( &scale, &e, sizeof ( T ) );
+
+  return T ( 1 ) / ( T ( 1 ) + p * scale );
+}
+
+template <typename T>
+inline void logistic_scalar ( T * y, const T * x, int n )
+{
+  for ( int j {0}; j < n; ++j )
+    y[j] = logistic ( x[j] );
+}
+
+template <typename T, int B>
+inline void logistic_vec ( T * y, const T * x, int n )
+{
+  typedef Logistic<T> L;
+  typedef typename L::I I;
+  typedef T V __attribute__ ( ( vector_size ( B ) ) );
+  typedef I VI __attribute__ ( ( vector_size ( B ) ) );
+  const int m = B / sizeof ( T );
+
+  const T round = L::round;
+  I rb;
+  std::memcpy ( &rb, &round, sizeof ( T ) );
+
+  int j {0};
+  for ( ; j + m <= n; j += m )
+    {
+      V v;
+      std::memcpy ( &v, x + j, B );
+
+      V z = v > L::lim ? -L::lim : v < -L::lim ? L::lim : -v;
+
+      V t = z * L::log2e + L::round;
+      V k = t - L::round;
+      V r = ( z - k * L::ln2_hi ) - k * L::ln2_lo;
+
+      V p = L::coeff[L::degree] + V {};
+      for ( int i {L::degree - 1}; i >= 0; --i )
+        p = p * r + L::coeff[i];
+
+      VI e = ( ( VI ) t - rb + L::bias ) << L::mantissa;
+
+      v = 1 / ( 1 + p * ( V ) e );
+      std::memcpy ( y + j, &v, B );
+    }
+
+  logistic_scalar ( y + j, x + j, n - j );
+}
+
+#ifdef SIMD_X86
+
+template <typename T>
+__attribute__ ( ( target ( "sse2" ), flatten ) )
+void logistic_sse2 ( T * y, const T * x, int n )
+{
+  logistic_vec<T, 16> ( y, x, n );
+}
+
+template <typename T>
+__attribute__ ( ( target ( "avx2,fma" ), flatten ) )
+void logistic_avx2 ( T * y, const T * x, int n )
+{
+  logistic_vec<T, 32> ( y, x, n );
+}
+
+template <typename T>
+__attribute__ ( ( target ( "avx512f" ), flatten ) )
+void logistic_avx512 ( T * y, const T * x, int n )
+{
+  logistic_vec<T, 64> ( y, x, n );
+}
+
+#endif
+
+template <typename T>
+inline void logistic ( T * y, const T * x, int n )
+{
+  typedef void ( *kernel_t ) ( T *, const T *, int );
+
+  static const kernel_t kernel = [] () -> kernel_t
+  {
+    switch ( simd_isa() )
+      {
+#ifdef SIMD_X86
+      case AVX512:
+        return logistic_avx512<T>;
+      case AVX2:
+        return logistic_avx2<T>;
+      case SSE2:
+        return logistic_sse2<T>;
+#endif
+      default:
+        return logistic_scalar<T>;
+      }
+  } ();
+
+  kernel ( y, x, n );
+}
+
+// Int8 GEMV for the quantized perceptrons: the products are accumulated
+// in int32, so the caller rescales y by the scales of w and x.
+
+inline void qgemv_scalar ( const int8_t * w, int stride, int rows, const int8_t * x, int n, int32_t * y )
+{
+  for ( int j {0}; j < rows; ++j, w += stride )
+    {
+      int32_t u {0};
+
+      for ( int k {0}; k < n; ++k )
+        u += w[k] * x[k];
+
+      y[j] = u;
+    }
+}
+
+#ifdef SIMD_X86
+
+__attribute__ ( ( target ( "avx2" ) ) )
+inline int32_t hsum_epi32 ( __m256i v )
+{
+  __m128i s = _mm_add_epi32 ( _mm256_castsi256_si128 ( v ), _mm256_extracti128_si256 ( v, 1 ) );
+  s = _mm_add_epi32 ( s, _mm_shuffle_epi32 ( s, 0x4e ) );
+  s = _mm_add_epi32 ( s, _mm_shuffle_epi32 ( s, 0xb1 ) );
+
+  return _mm_cvtsi128_si32 ( s );
+}
+
+__attribute__ ( ( target ( "avx2" ) ) )
+inline void qgemv_avx2 ( const int8_t * w, int stride, int rows, const int8_t * x, int n, int32_t * y )
+{
+  for ( int j {0}; j < rows; ++j, w += stride )
+    {
+      __m256i a = _mm256_setzero_si256();
+
+      int k {0};
+      for ( ; k + 32 <= n; k += 32 )
+        {
+          __m256i xv = _mm256_loadu_si256 ( reinterpret_cast<const __m256i *> ( x + k ) );
+          __m256i wv = _mm256_loadu_si256 ( reinterpret_cast<const __m256i *> ( w + k ) );
+
+          __m256i x0 = _mm256_cvtepi8_epi16 ( _mm256_castsi256_si128 ( xv ) );
+          __m256i x1 = _mm256_cvtepi8_epi16 ( _mm256_extracti128_si256 ( xv, 1 ) );
+          __m256i w0 = _mm256_cvtepi8_epi16 ( _mm256_castsi256_si128 ( wv ) );
+          __m256i w1 = _mm256_cvtepi8_epi16 ( _mm256_extracti128_si256 ( wv, 1 ) );
+
+          a = _mm256_add_epi32 ( a, _mm256_madd_epi16 ( w0, x0 ) );
+          a = _mm256_add_epi32 ( a, _mm256_madd_epi16 ( w1, x1 ) );
+        }
+
+      int32_t u = hsum_epi32 ( a );
+      for ( ; k < n; ++k )
+        u += w[k] * x[k];
+
+      y[j] = u;
+    }
+}
+
+#endif
+
+inline void qgemv ( const int8_t * w, int stride, int rows, const int8_t * x, int n, int32_t * y )
+{
+  typedef void ( *kernel_t ) ( const int8_t *, int, int, const int8_t *, int, int32_t * );
+
+  static const kernel_t kernel = [] () -> kernel_t
+  {
+    switch ( simd_isa() )
+      {
+#ifdef SIMD_X86
+      case AVX512:
+      case AVX2:
+        return qgemv_avx2;
+#endif
+      default:
+        return qgemv_scalar;
+      }
+  } ();
+
+  kernel ( w, stride, rows, x, n, y );
+}
+
+#endif
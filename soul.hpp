@@ -0,0 +1,395 @@
+#ifndef SOUL_HPP
+#define SOUL_HPP
+
+/**
+ * @brief JUDAH - Jacob is equipped with a text-based user interface
+ *
+ * @file soul.hpp
+ * @author  Norbert Bátfai <nbatfai@gmail.com>
+ * @version 0.0.1
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2015 Norbert Bátfai, batfai.norbert@inf.unideb.hu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * JACOB, https://github.com/nbatfai/jacob
+ *
+ * "The son of Isaac is Jacob." The project called Jacob is an experiment
+ * to replace Isaac's (GUI based) visual imagination with a character console.
+ *
+ * ISAAC, https://github.com/nbatfai/isaac
+ *
+ * "The son of Samu is Isaac." The project called Isaac is a case study
+ * of using deep Q learning with neural networks for predicting the next
+ * sentence of a conversation.
+ *
+ * SAMU, https://github.com/nbatfai/samu
+ *
+ * The main purpose of this project is to allow the evaluation and
+ * verification of the results of the paper entitled "A disembodied
+ * developmental robotic agent called Samu Bátfai". It is our hope
+ * that Samu will be the ancestor of developmental robotics chatter
+ * bots that will be able to chat in natural language like humans do.
+ *
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SOUL_CRC_X86
+#endif
+
+// The binary soul. All the sections start at 64 byte boundaries:
+//
+//   header     SoulHeader
+//   trunk      perceptron block (TRUNK_PRCPS)
+//   perceptron blocks
+//   table      the triplets of the perceptrons with the offsets and
+//              the checksums of their blocks
+//   frqs       the factors of the scalings of the counts (version 3), then
+//              the frequency table, the states are given by their 64-bit
+//              fingerprints (version 2), the souls of version 1 have the
+//              text of the states instead
+//
+// A perceptron block is its number of layers and units (uint32) padded to
+// 64 bytes, followed by the rows of its weight matrices, each row padded
+// to 64 bytes, in the precision given by the header. The checksums are
+// CRC-32C.
+//
+// The delta checkpoints are appended to the journal of the soul (the file
+// name followed by .journal). A delta is a soul itself that holds only the
+// perceptrons and the frequencies that have changed since the previous
+// delta, its offsets are relative to its own header. The scalings of a
+// delta apply to all the counts before it. The deltas are
+// numbered; a soul records the number of the last delta it includes, and
+// the later ones are applied to it in order when it is loaded.
+
+static const char soul_magic[8] {'S', 'A', 'M', 'U', 'S', 'O', 'U', 'L'};
+static const uint32_t soul_version {3};
+
+struct SoulHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t real_size;
+  uint32_t n_prcps;
+  uint32_t trunk_crc;
+  uint64_t trunk;
+  uint64_t trunk_size;
+  uint64_t table;
+  uint64_t table_size;
+  uint64_t frqs;
+  uint64_t frqs_size;
+  uint32_t table_crc;
+  uint32_t frqs_crc;
+  // the number of the delta, or of the last delta included
+  uint32_t journal;
+  // of the previous fields
+  uint32_t header_crc;
+};
+
+static_assert ( sizeof ( SoulHeader ) == 88, "The layout of the soul header has changed." );
+
+inline uint32_t crc32c_scalar ( uint32_t crc, const unsigned char * p, std::size_t n )
+{
+  static const struct Table
+  {
+    Table()
+    {
+      for ( uint32_t i {0}; i < 256; ++i )
+        {
+          uint32_t c = i;
+
+          for ( int k {0}; k < 8; ++k )
+            c = c & 1 ? ( c >> 1 ) ^ 0x82f63b78 : c >> 1;
+
+          t[i] = c;
+        }
+    }
+
+    uint32_t t[256];
+  } table;
+
+  for ( std::size_t i {0}; i < n; ++i )
+    crc = table.t[ ( crc ^ p[i] ) & 0xff] ^ ( crc >> 8 );
+
+  return crc;
+}
+
+#ifdef SOUL_CRC_X86
+__attribute__ ( ( target ( "sse4.2" ) ) )
+inline uint32_t crc32c_sse42 ( uint32_t crc, const unsigned char * p, std::size_t n )
+{
+  uint64_t c = crc;
+
+  for ( ; n >= 8; n -= 8, p += 8 )
+    {
+      uint64_t v;
+      std::memcpy ( &v, p, 8 );
+      c = _mm_crc32_u64 ( c, v );
+    }
+
+  uint32_t c32 = c;
+  for ( ; n; --n, ++p )
+    c32 = _mm_crc32_u8 ( c32, *p );
+
+  return c32;
+}
+#endif
+
+// crc is the checksum of the preceding data, 0 at the beginning
+inline uint32_t crc32c ( uint32_t crc, const void * data, std::size_t n )
+{
+  typedef uint32_t ( *kernel_t ) ( uint32_t, const unsigned char *, std::size_t );
+
+  static const kernel_t kernel = [] () -> kernel_t
+  {
+#ifdef SOUL_CRC_X86
+    __builtin_cpu_init();
+
+    if ( __builtin_cpu_supports ( "sse4.2" ) )
+      return crc32c_sse42;
+#endif
+
+    return crc32c_scalar;
+  } ();
+
+  return ~kernel ( ~crc, static_cast<const unsigned char *> ( data ), n );
+}
+
+// Writes the sections of a binary soul and sums up their checksums.
+class SoulWriter
+{
+public:
+  SoulWriter ( std::ostream & out ) : out ( out )
+  {}
+
+  void write ( const void * data, std::size_t n )
+  {
+    out.write ( static_cast<const char *> ( data ), n );
+    crc = crc32c ( crc, data, n );
+    pos += n;
+  }
+
+  template <typename T>
+  void put ( T v )
+  {
+    write ( &v, sizeof ( T ) );
+  }
+
+  void put ( const std::string & s )
+  {
+    put<uint32_t> ( s.size() );
+    write ( s.data(), s.size() );
+  }
+
+  // zero padding to the next 64 byte boundary
+  void align ( void )
+  {
+    static const char zeros[64] {};
+
+    if ( pos % 64 )
+      write ( zeros, 64 - pos % 64 );
+  }
+
+  // starts a new checksum
+  uint32_t begin ( void )
+  {
+    uint32_t c = crc;
+    crc = 0;
+
+    return c;
+  }
+
+  uint32_t checksum ( void ) const
+  {
+    return crc;
+  }
+
+  uint64_t tell ( void ) const
+  {
+    return pos;
+  }
+
+  bool good ( void ) const
+  {
+    return out.good();
+  }
+
+private:
+  std::ostream & out;
+  uint32_t crc {0};
+  uint64_t pos {0};
+};
+
+// Reads the sections of a binary soul and sums up their checksums.
+class SoulReader
+{
+public:
+  SoulReader ( std::istream & in, uint32_t real_size ) : real_size ( real_size ), in ( in )
+  {}
+
+  void read ( void * data, std::size_t n )
+  {
+    if ( !in.read ( static_cast<char *> ( data ), n ) )
+      throw "The soul is truncated.";
+
+    crc = crc32c ( crc, data, n );
+    pos += n;
+  }
+
+  template <typename T>
+  T get ( void )
+  {
+    T v;
+    read ( &v, sizeof ( T ) );
+
+    return v;
+  }
+
+  std::string get_string ( void )
+  {
+    uint32_t n = get<uint32_t>();
+
+    // before the checksum of the section is known
+    if ( n > 1u << 20 )
+      throw "The soul is corrupted.";
+
+    std::string s ( n, '\0' );
+    read ( &s[0], n );
+
+    return s;
+  }
+
+  void align ( void )
+  {
+    char pad[64];
+
+    if ( pos % 64 )
+      read ( pad, 64 - pos % 64 );
+  }
+
+  void seek ( uint64_t offset )
+  {
+    in.seekg ( base + offset );
+    pos = offset;
+  }
+
+  // the file offset of the header, the offsets of the sections are relative to it
+  void set_base ( std::streamoff base )
+  {
+    this->base = base;
+  }
+
+  void begin ( void )
+  {
+    crc = 0;
+  }
+
+  // a whole section, it is parsed only if its checksum matches
+  std::string section ( uint64_t offset, uint64_t size, uint32_t crc, const char * err )
+  {
+    if ( size > 1ull << 40 )
+      throw err;
+
+    std::string data ( size, '\0' );
+
+    seek ( offset );
+    begin();
+    read ( &data[0], size );
+    check ( crc, err );
+
+    return data;
+  }
+
+  // throws err if the data read since begin() does not match the checksum
+  void check ( uint32_t crc, const char * err ) const
+  {
+    if ( this->crc != crc )
+      throw err;
+  }
+
+  // rows of n weights in the precision of the soul are padded to
+  static int padded ( int n, uint32_t real_size )
+  {
+    const int m = 64 / real_size;
+
+    return ( ( n + m - 1 ) / m ) * m;
+  }
+
+  const uint32_t real_size;
+
+private:
+  std::istream & in;
+  std::streamoff base {0};
+  uint32_t crc {0};
+  uint64_t pos {0};
+};
+
+// A soul file mapped into the memory privately: its pages are read on first
+// use and a page becomes a private copy only when it is written, the file
+// itself is never modified.
+class SoulMapping
+{
+public:
+  SoulMapping ( const std::string & fname )
+  {
+    int fd = open ( fname.c_str(), O_RDONLY );
+
+    if ( fd == -1 )
+      return;
+
+    struct stat st;
+
+    if ( !fstat ( fd, &st ) && st.st_size > 0 )
+      {
+        void * p = mmap ( nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+
+        if ( p != MAP_FAILED )
+          {
+            data = static_cast<char *> ( p );
+            size = st.st_size;
+          }
+      }
+
+    close ( fd );
+  }
+
+  ~SoulMapping()
+  {
+    if ( data )
+      munmap ( data, size );
+  }
+
+  SoulMapping ( const SoulMapping & ) = delete;
+  SoulMapping & operator= ( const SoulMapping & ) = delete;
+
+  char * data {nullptr};
+  std::size_t size {0};
+};
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @brief JUDAH - Jacob is equipped with a text-based user interface
+ *
+ * @file tests/alloc.cpp
+ * @author  Norbert Bátfai <nbatfai@gmail.com>
+ * @version 0.0.1
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2015 Norbert Bátfai, batfai.norbert@inf.unideb.hu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * JACOB, https://github.com/nbatfai/jacob
+ *
+ * "The son of Isaac is Jacob." The project called Jacob is an experiment
+ * to replace Isaac's (GUI based) visual imagination with a character console.
+ *
+ * ISAAC, https://github.com/nbatfai/isaac
+ *
+ * "The son of Samu is Isaac." The project called Isaac is a case study
+ * of using deep Q learning with neural networks for predicting the next
+ * sentence of a conversation.
+ *
+ * SAMU, https://github.com/nbatfai/samu
+ *
+ * The main purpose of this project is to allow the evaluation and
+ * verification of the results of the paper entitled "A disembodied
+ * developmental robotic agent called Samu Bátfai". It is our hope
+ * that Samu will be the ancestor of developmental robotics chatter
+ * bots that will be able to chat in natural language like humans do.
+ *
+ */
+
+// A learning step of a perceptron does not touch the heap: the units,
+// the weights and the deltas live in the arena of the perceptron. The
+// global operator new is replaced with a counting one, and the count must
+// not change over the forward passes and the learning steps, dense and
+// sparse alike.
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "ql.hpp"
+
+static unsigned long allocations {0};
+
+void * operator new ( std::size_t size )
+{
+  ++allocations;
+
+  if ( void * p = std::malloc ( size ? size : 1 ) )
+    return p;
+
+  throw std::bad_alloc();
+}
+
+void operator delete ( void * p ) noexcept
+{
+  std::free ( p );
+}
+
+void operator delete ( void * p, std::size_t ) noexcept
+{
+  std::free ( p );
+}
+
+static int steps ( Perceptron & p, Real image [], int n, bool sparse )
+{
+  ActiveInputs active;
+  active ( image, n );
+  active.sparse = sparse;
+
+  // the first step may set up lazily, it is not counted
+  p.learning ( image, .7, p ( image, active ), &active );
+
+  unsigned long before {allocations};
+
+  for ( int s {0}; s < 1000; ++s )
+    {
+      double q = p ( image, active );
+      p.learning ( image, s % 2 ? .7 : .3, q, &active );
+    }
+
+  unsigned long count {allocations - before};
+
+  std::printf ( "%d inputs, %s: %lu allocations in 1000 steps\n", n, sparse ? "sparse" : "dense", count );
+
+  return count ? 1 : 0;
+}
+
+int main ( void )
+{
+  int failed {0};
+
+  Real image[10*80] {};
+  for ( int k {0}; k < 10*80; k += 7 )
+    image[k] = ( k % 26 ) / 255.0;
+
+  Perceptron console ( 3, 10*80, 32, 1 );
+  failed += steps ( console, image, 10*80, false );
+  failed += steps ( console, image, 10*80, true );
+
+  Perceptron small ( 3, 256, 80, 1 );
+  failed += steps ( small, image, 256, false );
+
+  return failed;
+}
@@ -0,0 +1,180 @@
+/**
+ * @brief JUDAH - Jacob is equipped with a text-based user interface
+ *
+ * @file tests/logistic.cpp
+ * @author  Norbert Bátfai <nbatfai@gmail.com>
+ * @version 0.0.1
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2015 Norbert Bátfai, batfai.norbert@inf.unideb.hu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * JACOB, https://github.com/nbatfai/jacob
+ *
+ * "The son of Isaac is Jacob." The project called Jacob is an experiment
+ * to replace Isaac's (GUI based) visual imagination with a character console.
+ *
+ * ISAAC, https://github.com/nbatfai/isaac
+ *
+ * "The son of Samu is Isaac." The project called Isaac is a case study
+ * of using deep Q learning with neural networks for predicting the next
+ * sentence of a conversation.
+ *
+ * SAMU, https://github.com/nbatfai/samu
+ *
+ * The main purpose of this project is to allow the evaluation and
+ * verification of the results of the paper entitled "A disembodied
+ * developmental robotic agent called Samu Bátfai". It is our hope
+ * that Samu will be the ancestor of developmental robotics chatter
+ * bots that will be able to chat in natural language like humans do.
+ *
+ */
+
+// The error of the vectorized logistic function against the exact
+// 1/(1+exp(-x)), computed in long double. On [-lim, lim] both the absolute
+// and the relative error are bounded, beyond it (and at the infinities) the
+// result saturates to 1 or to below 1e-30. The scalar function, each kernel
+// the CPU supports and the dispatched one are checked, in place too, with
+// lengths that leave a scalar tail after the vectors.
+
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "simd.hpp"
+
+template <typename T>
+struct Bound
+{
+  static constexpr double abs = sizeof ( T ) == 8 ? 5e-16 : 2e-7;
+  static constexpr double rel = sizeof ( T ) == 8 ? 1e-15 : 5e-7;
+};
+
+template <typename T>
+static std::vector<T> arguments ( void )
+{
+  std::vector<T> x;
+
+  // a dense grid over the range the activations take
+  for ( int i {-200000}; i <= 200000; ++i )
+    x.push_back ( i * T ( 1e-3 ) );
+
+  // saturation, on both sides of the clamp
+  for ( T s : {T ( 1 ), T ( -1 ) } )
+    {
+      x.push_back ( s * Logistic<T>::lim );
+      x.push_back ( s * Logistic<T>::lim * T ( 1.5 ) );
+      x.push_back ( s * T ( 1e30 ) );
+      x.push_back ( s * std::numeric_limits<T>::infinity() );
+    }
+
+  x.push_back ( 0 );
+  x.push_back ( std::numeric_limits<T>::min() );
+  x.push_back ( -std::numeric_limits<T>::min() );
+
+  return x;
+}
+
+template <typename T>
+static int check ( const char * name, const std::vector<T> & x, const std::vector<T> & y )
+{
+  double max_abs {0.0}, max_rel {0.0};
+  int failed {0};
+
+  for ( std::size_t j {0}; j < x.size(); ++j )
+    {
+      long double exact = 1.0L / ( 1.0L + std::exp ( - ( long double ) x[j] ) );
+      double abs = std::fabs ( ( double ) ( y[j] - exact ) );
+
+      if ( !( y[j] >= 0 && y[j] <= 1 ) )
+        ++failed;
+
+      if ( std::fabs ( x[j] ) <= Logistic<T>::lim )
+        {
+          double rel = abs / ( double ) exact;
+
+          max_abs = std::max ( max_abs, abs );
+          max_rel = std::max ( max_rel, rel );
+
+          if ( abs > Bound<T>::abs || rel > Bound<T>::rel )
+            ++failed;
+        }
+      else if ( x[j] > 0 ? y[j] != 1 : y[j] > 1e-30 )
+        ++failed;
+    }
+
+  std::printf ( "%-6s %-6s max abs %.2g, max rel %.2g, %d failed\n",
+                sizeof ( T ) == 8 ? "double" : "float", name, max_abs, max_rel, failed );
+
+  return failed ? 1 : 0;
+}
+
+template <typename T>
+static int paths ( void )
+{
+  typedef void ( *kernel_t ) ( T *, const T *, int );
+
+  std::vector<T> x = arguments<T>();
+  std::vector<T> y ( x.size() );
+  int failed {0};
+
+  for ( std::size_t j {0}; j < x.size(); ++j )
+    y[j] = logistic ( x[j] );
+  failed += check ( "scalar", x, y );
+
+  std::vector<std::pair<const char *, kernel_t>> kernels {{"array", logistic_scalar<T>}};
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports ( "sse2" ) )
+    kernels.push_back ( {"sse2", logistic_sse2<T>} );
+  if ( __builtin_cpu_supports ( "avx2" ) && __builtin_cpu_supports ( "fma" ) )
+    kernels.push_back ( {"avx2", logistic_avx2<T>} );
+  if ( __builtin_cpu_supports ( "avx512f" ) )
+    kernels.push_back ( {"avx512", logistic_avx512<T>} );
+#endif
+
+  for ( auto & k : kernels )
+    {
+      k.second ( y.data(), x.data(), x.size() );
+      failed += check ( k.first, x, y );
+    }
+
+  // the dispatched one, in place, with every tail length up to two vectors
+  // of float on AVX-512
+  std::vector<T> xs, ys;
+  for ( int n {1}; n <= 33; ++n )
+    {
+      std::vector<T> z ( x.begin() + 190000, x.begin() + 190000 + n );
+
+      xs.insert ( xs.end(), z.begin(), z.end() );
+      logistic ( z.data(), z.data(), n );
+      ys.insert ( ys.end(), z.begin(), z.end() );
+    }
+  failed += check ( "tails", xs, ys );
+
+  logistic ( y.data(), x.data(), x.size() );
+  failed += check ( "dispatched", x, y );
+
+  return failed;
+}
+
+int main ( void )
+{
+  return paths<double>() + paths<float>();
+}
@@ -0,0 +1,272 @@
+/**
+ * @brief JUDAH - Jacob is equipped with a text-based user interface
+ *
+ * @file tests/soul.cpp
+ * @author  Norbert Bátfai <nbatfai@gmail.com>
+ * @version 0.0.1
+ *
+ * @section LICENSE
+ *
+ * Copyright (C) 2015 Norbert Bátfai, batfai.norbert@inf.unideb.hu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * JACOB, https://github.com/nbatfai/jacob
+ *
+ * "The son of Isaac is Jacob." The project called Jacob is an experiment
+ * to replace Isaac's (GUI based) visual imagination with a character console.
+ *
+ * ISAAC, https://github.com/nbatfai/isaac
+ *
+ * "The son of Samu is Isaac." The project called Isaac is a case study
+ * of using deep Q learning with neural networks for predicting the next
+ * sentence of a conversation.
+ *
+ * SAMU, https://github.com/nbatfai/samu
+ *
+ * The main purpose of this project is to allow the evaluation and
+ * verification of the results of the paper entitled "A disembodied
+ * developmental robotic agent called Samu Bátfai". It is our hope
+ * that Samu will be the ancestor of developmental robotics chatter
+ * bots that will be able to chat in natural language like humans do.
+ *
+ */
+
+// The migration of a text soul to the binary soul and its journal: the text
+// soul is converted while a journal of another soul is left next to it, the
+// learning goes on with delta checkpoints and scalings of the counts until
+// the journal is compacted, and the soul that is loaded again must be the
+// same as the one in memory. The same holds for a snapshot taken while
+// scalings were pending, for a run that crashed after its checkpoints, and
+// for a run that starts beside the journal of a crashed run whose soul is
+// gone.
+
+#include <cstdio>
+#include <sstream>
+#include <unistd.h>
+
+#include "ql.hpp"
+
+static Real image[10*80];
+
+static void step ( QL & ql, int s, int n )
+{
+  std::stringstream o;
+  o << "o" << s % n;
+
+  for ( int k {0}; k < 10*80; ++k )
+    image[k] = ( ( k * 7 + s * 13 ) % 97 ) / 97.0;
+
+  ql ( SPOTriplet ( "i", "am", o.str() ), fingerprint ( o.str() ), image );
+}
+
+static std::string slurp ( const std::string & fname )
+{
+  std::ifstream in ( fname, std::ios_base::binary );
+  std::stringstream s;
+  s << in.rdbuf();
+  return s.str();
+}
+
+static std::string text_of ( QL & ql, const char * fname )
+{
+  std::string t {fname};
+  ql.save_text ( t );
+  return slurp ( t );
+}
+
+// the souls, their journals and the texts of the test, before and after it
+static void clean ( void )
+{
+  const char * names[] {"migration", "snapshot", "crash"};
+  const char * suffixes[] {".soul", ".soul.journal", ".soul.journal.old", ".soul.compact",
+                           ".soul.tmp", ".soul.txt", ".before.txt", ".after.txt"
+                          };
+
+  for ( const char * name : names )
+    for ( const char * suffix : suffixes )
+      std::remove ( ( std::string ( name ) + suffix ).c_str() );
+}
+
+// n steps from the step first with a checkpoint every 10 steps
+static void run ( QL & ql, std::string & soul, int first, int n, int actions )
+{
+  for ( int s {first}; s < first + n; ++s )
+    {
+      step ( ql, s, actions );
+
+      if ( s % 10 == 9 )
+        ql.checkpoint ( soul );
+    }
+}
+
+int main ( void )
+{
+  std::string text {"migration.soul.txt"}, soul {"migration.soul"};
+  clean();
+
+  // a text soul of 20 actions
+  {
+    QL ql ( 10 );
+    for ( int s {0}; s < 20; ++s )
+      step ( ql, s, 20 );
+    ql.save_text ( text );
+  }
+
+  // the journal of another soul whose soul is gone
+  {
+    QL ql ( 10 );
+    run ( ql, soul, 100, 20, 200 );
+  }
+  std::remove ( soul.c_str() );
+
+  std::string before, after;
+
+  {
+    QL ql ( 10 );
+    std::fstream file ( text, std::ios_base::in );
+    ql.convert ( file, soul );
+
+    for ( int s {0}; s < 400; ++s )
+      {
+        step ( ql, s, 3 );
+
+        if ( s % 40 == 39 )
+          ql.scalen ( .9 );
+
+        if ( s % 10 == 9 )
+          ql.checkpoint ( soul );
+      }
+
+    ql.checkpoint ( soul );
+
+    before = text_of ( ql, "migration.before.txt" );
+  }
+
+  // a compacted soul includes some deltas
+  SoulHeader header {};
+  std::ifstream in ( soul, std::ios_base::binary );
+  in.read ( reinterpret_cast<char *> ( &header ), sizeof ( header ) );
+  bool compacted = header.journal > 0;
+
+  {
+    QL ql ( 10 );
+    ql.load ( soul );
+
+    after = text_of ( ql, "migration.after.txt" );
+  }
+
+  bool same = before == after;
+  std::printf ( "compacted %d, reloaded soul %s\n", compacted, same ? "identical" : "differs" );
+
+  // the scaled counts of the snapshot must not be scaled again by the next
+  // delta
+  std::string snapshot {"snapshot.soul"};
+
+  {
+    QL ql ( 10 );
+    for ( int s {0}; s < 200; ++s )
+      step ( ql, s, 3 );
+    ql.save ( snapshot );
+
+    ql.scalen ( .5 );
+    ql.snapshot ( snapshot );
+    while ( ql.snapshotting() )
+      usleep ( 1000 );
+
+    for ( int s {0}; s < 10; ++s )
+      step ( ql, s, 2 );
+    ql.scalen ( .5 );
+    ql.checkpoint ( snapshot );
+
+    before = text_of ( ql, "snapshot.before.txt" );
+  }
+
+  {
+    QL ql ( 10 );
+    ql.load ( snapshot );
+
+    after = text_of ( ql, "snapshot.after.txt" );
+  }
+
+  bool same_snapshot = before == after;
+  std::printf ( "reloaded snapshot %s\n", same_snapshot ? "identical" : "differs" );
+
+  // a run without a soul crashes after its checkpoints, the next one goes
+  // on from them and crashes after a snapshot
+  std::string crash {"crash.soul"};
+
+  {
+    QL ql ( 10 );
+    run ( ql, crash, 0, 50, 5 );
+
+    before = text_of ( ql, "crash.before.txt" );
+  }
+
+  bool recovered {false};
+
+  {
+    QL ql ( 10 );
+    ql.load ( crash );
+
+    recovered = text_of ( ql, "crash.after.txt" ) == before;
+
+    run ( ql, crash, 50, 20, 7 );
+    ql.snapshot ( crash );
+    while ( ql.snapshotting() )
+      usleep ( 1000 );
+    run ( ql, crash, 70, 10, 7 );
+
+    before = text_of ( ql, "crash.before.txt" );
+  }
+
+  {
+    QL ql ( 10 );
+    ql.load ( crash );
+
+    recovered = recovered && text_of ( ql, "crash.after.txt" ) == before;
+  }
+
+  // the soul of the crashed run is gone, its journal must not be applied to
+  // the soul of the next run
+  std::remove ( crash.c_str() );
+
+  {
+    QL ql ( 10 );
+    run ( ql, crash, 200, 20, 3 );
+    ql.snapshot ( crash );
+    while ( ql.snapshotting() )
+      usleep ( 1000 );
+    run ( ql, crash, 220, 10, 3 );
+
+    before = text_of ( ql, "crash.before.txt" );
+  }
+
+  {
+    QL ql ( 10 );
+    ql.load ( crash );
+
+    after = text_of ( ql, "crash.after.txt" );
+  }
+
+  bool orphaned = before == after;
+  std::printf ( "crashed run %s, journal without its soul %s\n", recovered ? "recovered" : "lost",
+                orphaned ? "dropped" : "applied" );
+
+  clean();
+
+  return same && compacted && same_snapshot && recovered && orphaned ? 0 : 1;
+}